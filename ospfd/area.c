@@ -2,6 +2,8 @@
 #include "ospfd.h"
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 area *lookup_area_by_if(const interface_data *iface){
 	for(int i = 0; i < num_area; i++){
@@ -40,22 +42,115 @@ area *area_init(uint32_t area_id){
 	if(a != NULL){
 		return a;
 	}
-	areas[0].id = area_id;
-	areas[0].num_area = 0;
-	areas[0].num_if = 0;
-	areas[0].num_lsa = 0;
-	areas[0].num_vertex = 0;
-	areas[0].transit_capability = OSPFD_FALSE;
-	areas[0].external_routing_capability = OSPFD_FALSE;
-	areas[0].stub_default_cost = 0;
+	a = &areas[num_area];
+	a->id = area_id;
+	a->num_area = 0;
+	a->num_if = 0;
+	a->num_lsa = 0;
+	area_reserve_lsas(a, LIST_MAX);
+	a->num_ref = 0;
+	a->ref_free = -1;
+	a->num_vertex = 0;
+	area_reserve_vertices(a, NUM_VERTEX);
+	spf_queue_init(&a->queue, spf_queue_type);
+	a->num_transit = 0;
+	a->num_spf_change = 0;
+	a->spf_full = OSPFD_TRUE;
+	a->spf_dirty = OSPFD_FALSE;
+	a->lsdb_version = 0;
+	a->router_lsa_time = 0;
+	a->db_summary = NULL;
+	a->topo_hash = 0;
+	a->memo_clock = 0;
+	a->transit_capability = OSPFD_FALSE;
+	/* areas are not configured as stubs */
+	a->external_routing_capability = OSPFD_TRUE;
+	a->stub_default_cost = 0;
 	num_area++;
-	return &areas[0];
+	return a;
 }
 
 void add_area_ifs(area *a, interface_data *iface){
 	a->ifs[a->num_if++] = iface;
 }
 
+void area_reserve_lsas(area *a, int num){
+	if(num <= a->max_lsa){
+		return ;
+	}
+	int max = a->max_lsa ? a->max_lsa : LIST_MAX;
+	while(max < num){
+		max *= 2;
+	}
+	a->lsas = realloc(a->lsas, max * sizeof(ospf_lsa_header *));
+	a->vecs = realloc(a->vecs, max * sizeof(lsa_vec *));
+	a->lsa_next = realloc(a->lsa_next, max * sizeof(int));
+	a->lsa_hash = realloc(a->lsa_hash, max * sizeof(uint64_t));
+	memset(a->lsas + a->max_lsa, 0, (max - a->max_lsa) * sizeof(ospf_lsa_header *));
+	memset(a->vecs + a->max_lsa, 0, (max - a->max_lsa) * sizeof(lsa_vec *));
+	a->max_lsa = max;
+}
+
+void area_reserve_vertices(area *a, int num){
+	if(num <= a->max_vertex){
+		return ;
+	}
+	int max = a->max_vertex ? a->max_vertex : NUM_VERTEX;
+	while(max < num){
+		max *= 2;
+	}
+	a->vertices = realloc(a->vertices, max * sizeof(vertex));
+	a->max_vertex = max;
+}
+
+/* append an entry to the shortest-path tree; this may move a->vertices */
+vertex *add_vertex(area *a){
+	area_reserve_vertices(a, a->num_vertex + 1);
+	return &a->vertices[a->num_vertex++];
+}
+
+vertex *vertex_set_lookup(const vertex_set *s, uint64_t key){
+	int i = hash_index_get(&s->index, key);
+	return (i == -1) ? NULL : &s->entries[i];
+}
+
+/* find the entry for key, adding an empty one if there is none */
+vertex *vertex_set_put(vertex_set *s, uint64_t key){
+	int i = hash_index_get(&s->index, key);
+	if(i != -1){
+		return &s->entries[i];
+	}
+	if(s->num == s->max){
+		s->max = s->max ? s->max * 2 : NUM_VERTEX;
+		s->entries = realloc(s->entries, s->max * sizeof(vertex));
+		s->keys = realloc(s->keys, s->max * sizeof(uint64_t));
+	}
+	i = s->num++;
+	hash_index_put(&s->index, key, i);
+	s->keys[i] = key;
+	memset(&s->entries[i], 0, sizeof(vertex));
+	return &s->entries[i];
+}
+
+/* the last entry takes the place of the deleted one */
+void vertex_set_del(vertex_set *s, uint64_t key){
+	int i = hash_index_get(&s->index, key);
+	if(i == -1){
+		return ;
+	}
+	hash_index_del(&s->index, key);
+	if(i != --s->num){
+		s->entries[i] = s->entries[s->num];
+		s->keys[i] = s->keys[s->num];
+		hash_index_put(&s->index, s->keys[i], i);
+	}
+}
+
+void vertex_set_clear(vertex_set *s){
+	s->num = 0;
+	hash_index_clear(&s->index);
+}
+
 int lookup_least_cost_vertex(area *a){
 	int i;
 	int index = a->num_vertex;
@@ -2,6 +2,8 @@
 #define _AREA_H
 
 #include "interface.h"
+#include "hash.h"
+#include "pqueue.h"
 #include "shared.h"
 
 #include <netinet/in.h>
@@ -28,6 +30,40 @@ struct interface_data;
    shortest path calculation, the following data is also associated
    with each transit vertex: */
 
+/* A router-LSA or network-LSA decoded once when it is installed (see
+   install_lsa()). Metrics are kept in host order, and each link
+   remembers whether the vertex at its far end links back to this one
+   (Section 16.1 (2)(b)), so the Dijkstra calculation never needs to
+   touch the raw network-byte-order LSA. */
+typedef struct spf_link{
+	/* Link ID of the router link, or the Router ID of an attached
+	   router for a network-LSA. */
+	in_addr_t id;
+	in_addr_t data;
+
+	/* RTR_LSA_ROUTER, RTR_LSA_TRANSIT or RTR_LSA_STUB. The attached
+	   routers of a network-LSA are described as RTR_LSA_ROUTER. */
+	uint8_t type;
+
+	/* For network-LSAs this is the metric of the attached router's
+	   link back to the network. */
+	uint16_t metric;
+
+	/* OSPFD_TRUE if the LSA at the other end of the link also
+	   describes a link back to this vertex. */
+	int back_link;
+}spf_link;
+
+typedef struct lsa_vec{
+	uint8_t ls_type;
+	/* bits V, E and B of a router-LSA */
+	uint8_t flags;
+	in_addr_t id;
+	in_addr_t network_mask;
+	int num_link;
+	spf_link links[];
+}lsa_vec;
+
 typedef struct vertex{
 	/* Vertex (node) ID
        A 32-bit number which together with the vertex type (router
@@ -45,6 +81,7 @@ typedef struct vertex{
        network’s Designated Router). In any case, the LSA’s Link
        State ID is always equal to the above Vertex ID. */
 	const ospf_lsa_header *lsa;
+	const lsa_vec *vec;
 
 	/* List of next hops
        The list of next hops for the current set of shortest paths
@@ -65,8 +102,62 @@ typedef struct vertex{
        network-LSAs). One path is said to be "shorter" than
        another if it has a smaller link state cost. */
 	uint16_t dist;
+
+	/* Loop-free alternate (RFC 5286) - 
+	   The Router ID of a neighbor, other than the primary next hop,
+	   whose own shortest path to the vertex does not lead back through
+	   this router, and the cost of the path through it. 0 if there is
+	   no such neighbor. */
+	in_addr_t backup_hop;
+	uint16_t backup_dist;
 }vertex;
 
+/* The transit part of an area's graph in compressed sparse row form.
+   The links of transit vertex v are to[start[v]] to to[start[v + 1] - 1],
+   given as indices into the area's vertices with host-order metrics.
+   Only links that pass the back-link check of Section 16.1 (2)(b) are
+   kept, so the Dijkstra calculation never looks at an LSA. */
+typedef struct spf_graph{
+	int num_vertex;
+	int num_edge;
+	int max_vertex;
+	int max_edge;
+	int *start;
+	int *to;
+	uint16_t *metric;
+}spf_graph;
+
+/* Routing table entries derived from summary-LSAs and AS-external-LSAs
+   (Sections 16.2 and 16.4), one per destination, found by
+   HASH_KEY(LSA type, Destination ID). Keeping them apart from the
+   shortest-path tree lets a changed summary-LSA or AS-external-LSA be
+   dealt with by re-examining its own destination only. */
+typedef struct vertex_set{
+	int num;
+	int max;
+	vertex *entries;
+	uint64_t *keys;
+	hash_index index;
+}vertex_set;
+
+/* The transit part of a shortest-path tree saved for a topology the
+   area may return to (see calculate_intra_routes()). Entry i is the
+   transit vertex with key keys[i]; pre[] holds entry numbers. */
+typedef struct spf_memo{
+	uint64_t topo_hash;
+	/* when the entry was last saved or used, 0 if it is empty */
+	int last_use;
+	int num;
+	int max;
+	int root;
+	uint64_t *keys;
+	int *dist;
+	int *pre;
+	in_addr_t *next_hop;
+	in_addr_t *backup_hop;
+	uint16_t *backup_dist;
+}spf_memo;
+
 /* 6. The Area Data Structure */
 /* The area data structure contains all the information used to run the
    basic OSPF routing algorithm. Each area maintains its own link-state
@@ -89,6 +180,43 @@ typedef struct area_addr{
 	int state;
 }area_addr;
 
+/* AS-external-LSAs are flooded throughout the whole Autonomous System,
+   except into stub areas, so the router keeps a single copy of each
+   that all non-stub areas read from, laid out like the area link-state
+   database below. The instances are reference counted (see
+   hold_lsa()): the external routes calculated from an instance keep it
+   alive after a newer one has replaced it in the database. */
+typedef struct external_lsdb{
+	int num_lsa;
+	int max_lsa;
+	ospf_lsa_header **lsas;
+	uint64_t *lsa_hash;
+	hash_index lsa_index;
+	int *lsa_next;
+	/* counts the changes to the database, see db_snapshot */
+	uint64_t version;
+}external_lsdb;
+
+/* The headers of an area's link-state database as they were at some
+   moment, read-only once taken. The neighbors that go into Exchange
+   share the snapshot of their area until the database changes, each
+   keeping only a cursor into it (see take_db_summary()), so many
+   adjacencies coming up at once cost one copy of the headers. The
+   snapshot is freed when the area and the last of the neighbors have
+   let go of it. hdrs[0..num) is the Database summary list and
+   hdrs[num..num + num_maxage) the LSAs of age MaxAge, which go on the
+   neighbors' retransmission lists instead. */
+typedef struct db_snapshot{
+	int refs;
+	/* the lsdb_version of the area and the version of as_external
+	   when the snapshot was taken */
+	uint64_t version;
+	uint64_t external_version;
+	int num;
+	int num_maxage;
+	ospf_lsa_header hdrs[];
+}db_snapshot;
+
 typedef struct area{
 	/* Area ID - A 32-bit number identifying the area. The Area ID of 0.0.0.0 is
        reserved for the backbone. */
@@ -134,14 +262,126 @@ typedef struct area{
 	// struct ospf_lsa_header *slsas[LIST_MAX];
 	
 	int num_lsa;
-	ospf_lsa_header *lsas[LIST_MAX];
+	int max_lsa;
+	ospf_lsa_header **lsas;
+	/* decoded router-LSAs and network-LSAs, NULL for other LSA types */
+	lsa_vec **vecs;
+	/* hash of the body of each LSA (everything after the LSA header),
+	   to tell a refreshed instance from a changed one */
+	uint64_t *lsa_hash;
+	/* The LSAs sharing an LS type and Link State ID are chained through
+	   lsa_next[] (-1 ends the chain), starting from the entry of
+	   lsa_index for HASH_KEY(LS type, Link State ID). */
+	hash_index lsa_index;
+	int *lsa_next;
+	/* when the router last originated its router-LSA for the area, see
+	   originate_router_lsa() */
+	int64_t router_lsa_time;
+
+	/* Which decoded LSAs have links pointing at a router or transit
+	   network: for the vertex HASH_KEY(LS type, Vertex ID), the entry
+	   of ref_index starts a chain through ref_next[] (-1 ends it), and
+	   ref_lsa[] gives the position in lsas[] of each LSA on it. Unused
+	   entries are chained from ref_free. When an LSA is installed only
+	   the back-links of the LSAs on its chain are resolved again. */
+	hash_index ref_index;
+	int num_ref;
+	int max_ref;
+	int *ref_lsa;
+	int *ref_next;
+	int ref_free;
 
 	/* Shortest-path tree - 
 	   The shortest-path tree for the area, with this router itself as
 	   root. Derived from the collected router-LSAs and network-LSAs
 	   by the Dijkstra algorithm (see Section 16.1). */
 	int num_vertex;
-	vertex vertices[NUM_VERTEX];
+	int max_vertex;
+	vertex *vertices;
+
+	/* Index of the transit vertices by LSA type and Vertex ID, and the
+	   scratch buffers of the Dijkstra calculation. They are sized to
+	   the topology and reused from one calculation to the next. */
+	hash_index vertex_index;
+	int spf_cap;
+	/* distance from the root and type/ID key of each transit vertex */
+	int *spf_dist;
+	uint64_t *spf_key;
+	int *spf_use;
+	int *spf_pre;
+	int *spf_child;
+	int *spf_sibling;
+	int *spf_stack;
+	spf_queue queue;
+
+	/* Adjacency of the transit vertices. When the database changes only
+	   the rows of the vertices listed in graph_dirty (by HASH_KEY(LS
+	   type, Vertex ID)) are resolved again; the other rows are copied
+	   over from the previous graph (graph_spare). */
+	spf_graph graph;
+	spf_graph graph_spare;
+	key_set graph_dirty;
+
+	/* The transit part of the previous shortest-path tree (the first
+	   num_transit entries of vertices[] and spf_pre[]) is kept, so that
+	   when only a few router-LSAs and network-LSAs have changed since
+	   it was built it can be repaired instead of being recalculated
+	   from scratch. spf_changes lists the vertices whose LSA has been
+	   installed since then; spf_full is set when there were too many
+	   of them to bother. */
+	int num_transit;
+	int spf_root;
+	int num_spf_change;
+	uint64_t spf_changes[SPF_INCREMENTAL_MAX_CHANGES];
+	int spf_full;
+
+	/* The stub networks of transit vertex i are the leaves
+	   vertices[spf_leaf[i]] to vertices[spf_leaf[i + 1] - 1], and
+	   intra_count counts the entries of the tree for each Destination
+	   ID (keyed by HASH_KEY(0, id)). */
+	int *spf_leaf;
+	hash_index intra_count;
+
+	/* The routing table entries whose Destination Type is "router"
+	   (Section 16.1 (4)): the reachable routers of the area whose
+	   router-LSA has bit B (area border routers) or bit E (AS boundary
+	   routers) set, by HASH_KEY(OSPF_ROUTER_LSA, Router ID). They are
+	   collected once after the transit part of the tree is built, so
+	   that each summary-LSA and AS-external-LSA finds its advertising
+	   router with a single lookup. */
+	vertex_set abr;
+	vertex_set asbr;
+
+	/* Inter-area routes (Section 16.2) and AS external routes (Section
+	   16.4) calculated from this area's database. */
+	vertex_set inter;
+	vertex_set external;
+
+	/* What has changed since the routing table was last calculated
+	   when the transit part of the tree has not: routers whose stub
+	   links changed, summary-LSA and AS-external-LSA destinations, and
+	   AS boundary routers whose route changed (see spf_note_change()). */
+	key_set changed_leaves;
+	key_set changed_inter;
+	key_set changed_external;
+	key_set changed_asbr;
+
+	/* Fingerprint of the area's topology: the sum of a hash of every
+	   decoded router-LSA and network-LSA, kept up to date by
+	   install_lsa(). Sequence numbers and ages do not enter it. The
+	   trees of the last few topologies are kept in memo[]. */
+	uint64_t topo_hash;
+	int memo_clock;
+	spf_memo memo[SPF_MEMO_ENTRIES];
+
+	/* OSPFD_TRUE if the database has changed since the routing table
+	   was last calculated for the area */
+	int spf_dirty;
+
+	/* counts the changes to the area link-state database; db_summary
+	   is the latest snapshot of it, NULL if none has been taken */
+	uint64_t lsdb_version;
+	db_snapshot *db_summary;
 
 	/* TransitCapability - 
 	   This parameter indicates whether the area can carry data traffic
@@ -180,6 +420,13 @@ int lookup_vertex_by_id(area *a, in_addr_t id);
 area *lookup_area_by_id(uint32_t area_id);
 area *area_init(uint32_t area_id);
 void add_area_ifs(area *a, struct interface_data *iface);
+void area_reserve_lsas(area *a, int num);
+void area_reserve_vertices(area *a, int num);
+vertex *add_vertex(area *a);
+vertex *vertex_set_lookup(const vertex_set *s, uint64_t key);
+vertex *vertex_set_put(vertex_set *s, uint64_t key);
+void vertex_set_del(vertex_set *s, uint64_t key);
+void vertex_set_clear(vertex_set *s);
 int lookup_least_cost_vertex(area *a);
 int lookup_least_cost_vertex_by_id(area *a, in_addr_t id);
 
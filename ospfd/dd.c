@@ -2,26 +2,127 @@
 #include "ospfd.h"
 #include "lsa.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+static void add_snapshot_lsa(db_snapshot *s, int total, const ospf_lsa_header *lsa_hdr){
+	/* LSAs whose age is equal to MaxAge are instead added to the
+	   neighbor's Link state retransmission list; they fill the
+	   snapshot from the end. */
+	if(ntohs(lsa_hdr->ls_age) == MAX_AGE){
+		s->hdrs[total - ++s->num_maxage] = *lsa_hdr;
+	}
+	else{
+		s->hdrs[s->num++] = *lsa_hdr;
+	}
+}
+
+/* The router must list the contents of its entire area link state
+   database in the neighbor Database summary list. The area link state
+   database consists of the router-LSAs, network-LSAs and summary-LSAs
+   contained in the area structure, along with the AS-external-LSAs
+   contained in the global structure. AS-external-LSAs are omitted
+   from the Database summary list if the area has been configured as a
+   stub (see Section 3.6). */
+static db_snapshot *new_db_snapshot(const area *a){
+	int total = a->num_lsa + (a->external_routing_capability ? as_external.num_lsa : 0);
+	db_snapshot *s = malloc(sizeof(db_snapshot) + total * sizeof(ospf_lsa_header));
+	s->refs = 1;
+	s->version = a->lsdb_version;
+	s->external_version = as_external.version;
+	s->num = 0;
+	s->num_maxage = 0;
+	for(int i = 0; i < a->num_lsa; i++){
+		add_snapshot_lsa(s, total, a->lsas[i]);
+	}
+	if(a->external_routing_capability){
+		for(int i = 0; i < as_external.num_lsa; i++){
+			add_snapshot_lsa(s, total, as_external.lsas[i]);
+		}
+	}
+	return s;
+}
+
+void release_db_snapshot(db_snapshot *s){
+	if(s != NULL && --s->refs == 0){
+		free(s);
+	}
+}
+
+/* An LSA refreshed in place (see install_lsa()) leaves the set of LSAs
+   in the database the same, so the area's snapshot is kept and only the
+   header of the LSA, entry pos of the database (with the
+   AS-external-LSAs after the area's own), is brought up to date. Until
+   a MaxAge LSA has been moved to the end of the snapshot, that is entry
+   pos of the snapshot too. Returns OSPFD_FALSE if the snapshot has to
+   be taken again. */
+int refresh_db_summary(area *a, int pos, const ospf_lsa_header *lsa_hdr){
+	db_snapshot *s = a->db_summary;
+	if(s == NULL || s->version != a->lsdb_version ||
+		(a->external_routing_capability && s->external_version != as_external.version)){
+		return OSPFD_TRUE;
+	}
+	if(s->num_maxage > 0 || pos >= s->num){
+		return OSPFD_FALSE;
+	}
+	s->hdrs[pos] = *lsa_hdr;
+	return OSPFD_TRUE;
+}
+
+/* Give the neighbor the area's snapshot, taking a new one only if the
+   database has changed since the last was taken. */
+void take_db_summary(const interface_data *iface, neighbor *nbr){
+	area *a = lookup_area_by_if(iface);
+	clear_db_summary(nbr);
+	if(a == NULL){
+		return ;
+	}
+	db_snapshot *s = a->db_summary;
+	if(s == NULL || s->version != a->lsdb_version ||
+		(a->external_routing_capability && s->external_version != as_external.version)){
+		release_db_snapshot(s);
+		s = a->db_summary = new_db_snapshot(a);
+	}
+	s->refs++;
+	nbr->db_summary = s;
+	nbr->num_db_summary = s->num;
+	for(int i = 0; i < s->num_maxage; i++){
+		add_rxmt_lsa(nbr, &s->hdrs[s->num + i], 0);
+	}
+}
+
+/* the number of LSA headers that fit in a Database Description packet
+   sent out iface */
+static int dd_page_size(const interface_data *iface){
+	return (ospf_packet_size(iface) - sizeof(ospf_header) - sizeof(ospf_dd_pkt)) / sizeof(ospf_lsa_header);
+}
+
 void encapsulate_dd_pkt(const interface_data *iface, neighbor *nbr, ospf_header *ospf_hdr){
 	ospf_dd_pkt *dd = (ospf_dd_pkt *)((uint8_t *)ospf_hdr + sizeof(ospf_header));
 	ospf_lsa_header *lsa_hdr = dd->lsa_hdrs;
-	area *a = lookup_area_by_if(iface);
 
-	dd->interface_mtu = htons(DEFAULT_MTU);
+	dd->interface_mtu = htons(iface->mtu);
 	dd->options = OSPF_OPTIONS;
 	dd->flags = 0;
 	if(nbr->master_slave_relationship == DD_MASTER){
 		dd->flags |= DD_FLAG_MS;
 	}
 	if(nbr->state == NEIGHBOR_STATE_EX_START){
-		dd->flags |= DD_FLAG_I;
-	}
-	if(nbr->more){
-		dd->flags |= DD_FLAG_M;
+		dd->flags |= DD_FLAG_I | DD_FLAG_M;
 	}
 	dd->dd_seqnum = htonl(nbr->dd_seqnum);
+	/* the master times the slave's echo of each DD sequence number,
+	   unless the packet has to be sent again (Karn's algorithm) */
+	if(nbr->master_slave_relationship == DD_MASTER){
+		if(nbr->dd_time != 0 && nbr->dd_timed_seq == nbr->dd_seqnum){
+			nbr->dd_timed = OSPFD_FALSE;
+		}
+		else{
+			nbr->dd_time = monotonic_ms();
+			nbr->dd_timed_seq = nbr->dd_seqnum;
+			nbr->dd_timed = OSPFD_TRUE;
+		}
+	}
 	/* In state Exchange the Database Description Packets actually
        contain summaries of the link state information contained in the
        router’s database. Each LSA in the area’s link-state database
@@ -31,20 +132,52 @@ void encapsulate_dd_pkt(const interface_data *iface, neighbor *nbr, ospf_header
        neighbor data structure and then describes the current top of
        the Database summary list. Items are removed from the Database
        summary list when the previous packet is acknowledged. */
-	if(nbr->state == NEIGHBOR_STATE_EXCHANGE && nbr->more){
-		for(int i = 0; i < a->num_lsa; i++){
-			memcpy(lsa_hdr++, a->lsas[i], sizeof(ospf_lsa_header));
+	/* The top of the list is as many headers as the interface MTU
+	   allows; until they are acknowledged the same ones are sent
+	   again. */
+	if(nbr->state == NEIGHBOR_STATE_EXCHANGE){
+		int num = nbr->num_db_summary - nbr->db_cursor;
+		if(num > dd_page_size(iface)){
+			num = dd_page_size(iface);
+		}
+		memcpy(lsa_hdr, nbr->db_summary->hdrs + nbr->db_cursor, num * sizeof(ospf_lsa_header));
+		lsa_hdr += num;
+		nbr->dd_sent = num;
+		if(nbr->db_cursor + num < nbr->num_db_summary){
+			dd->flags |= DD_FLAG_M;
 		}
 	}
 	ospf_hdr->type = MSG_TYPE_DATABASE_DESCRIPTION;
 	ospf_hdr->pktlen = htons((uint8_t *)lsa_hdr - (uint8_t *)ospf_hdr);
 
-	memcpy(nbr->pre_dd_pkt + sizeof(struct iphdr), ospf_hdr, BUFFER_SIZE - sizeof(struct iphdr));
+	memcpy(nbr->pre_dd_pkt + sizeof(struct iphdr), ospf_hdr, ntohs(ospf_hdr->pktlen));
 }
 
 void process_dd_pkt(interface_data *iface, neighbor *nbr, const ospf_header *ospf_hdr){
 	ospf_dd_pkt *dd = (ospf_dd_pkt *)((uint8_t *)ospf_hdr + sizeof(ospf_header));
 	area *a = lookup_area_by_if(iface);
+
+	/* a Database Description packet from a router that is not yet a
+	   neighbor is dropped */
+	if(nbr == NULL){
+		return ;
+	}
+
+	/* 10.6. Receiving Database Description Packets */
+	/* If the Interface MTU field in the Database Description packet
+	   indicates an IP datagram size that is larger than the router can
+	   accept on the receiving interface without fragmentation, the
+	   Database Description packet is rejected. */
+	if(ntohs(dd->interface_mtu) > iface->mtu){
+		printf("Reject Database Description packet: MTU %d larger than %d.\n", ntohs(dd->interface_mtu), iface->mtu);
+		return ;
+	}
+	/* the neighbor has started the adjacency the router is holding back,
+	   see adj_admit() */
+	if(nbr->adj_waiting && (dd->flags & DD_FLAG_I)){
+		nbr->adj_peer_started = OSPFD_TRUE;
+		add_neighbor_event(iface, nbr, NEIGHBOR_EV_ADJ_OK);
+	}
 	/*
 	if(nbr->last_dd_flags == dd->flags && nbr->last_dd_options == dd->options 
 		&& htonl(nbr->last_dd_seqnum) == dd->dd_seqnum){
@@ -56,7 +189,7 @@ void process_dd_pkt(interface_data *iface, neighbor *nbr, const ospf_header *osp
 	if(dd->flags & DD_FLAG_I){
 		if((dd->flags & DD_FLAG_M) && ntohl(my_router_id) < ntohl(ospf_hdr->router_id)){
 			nbr->master_slave_relationship = DD_SLAVE;
-			nbr->dd_seqnum = dd->dd_seqnum;
+			nbr->dd_seqnum = ntohl(dd->dd_seqnum);
 			add_neighbor_event(iface, nbr, NEIGHBOR_EV_NEGOTIATION_DONE);
 		}
 	}
@@ -66,25 +199,35 @@ void process_dd_pkt(interface_data *iface, neighbor *nbr, const ospf_header *osp
 			add_neighbor_event(iface, nbr, NEIGHBOR_EV_NEGOTIATION_DONE);
 		}
 		if(nbr->master_slave_relationship == DD_MASTER){
-			if(htonl(nbr->dd_seqnum) == dd->dd_seqnum){
+			/* the slave acknowledges the packet by echoing its DD
+			   sequence number */
+			if(ntohl(dd->dd_seqnum) == nbr->dd_seqnum){
+				if(nbr->dd_timed && nbr->dd_timed_seq == nbr->dd_seqnum){
+					rtt_sample(nbr, monotonic_ms() - nbr->dd_time);
+					nbr->dd_timed = OSPFD_FALSE;
+				}
 				add_neighbor_event(iface, nbr, NEIGHBOR_EV_NEGOTIATION_DONE);
+				nbr->db_cursor += nbr->dd_sent;
+				nbr->dd_sent = 0;
 				nbr->dd_seqnum += 1;
-				if(!(dd->flags & DD_FLAG_M)){
+				nbr->more = dd->flags & DD_FLAG_M;
+				if(!(dd->flags & DD_FLAG_M) && nbr->db_cursor >= nbr->num_db_summary){
 					add_neighbor_event(iface, nbr, NEIGHBOR_EV_EXCHANGE_DONE);
 				}
 			}
 		}
 		else{
-			if(htonl(nbr->dd_seqnum) == dd->dd_seqnum-1){
+			/* the master's next packet, one DD sequence number on,
+			   acknowledges the slave's last */
+			if(ntohl(dd->dd_seqnum) == nbr->dd_seqnum + 1){
+				nbr->db_cursor += nbr->dd_sent;
+				nbr->dd_sent = 0;
 				nbr->dd_seqnum += 1;
 				nbr->more = dd->flags & DD_FLAG_M;
 			}
 		}
 		/* calculate the number of LSA */
 		int num = (ntohs(ospf_hdr->pktlen) - sizeof(ospf_header) - sizeof(ospf_dd_pkt)) / sizeof(ospf_lsa_header);
-		if(num == 0){
-		    nbr->more = 0;
-		}
 		for(int i = 0; i < num; i++){
 			ospf_lsa_header *lsa_hdr = lookup_lsa(a, dd->lsa_hdrs + i);
 			if(!lsa_hdr || cmp_lsa_hdr(lsa_hdr, dd->lsa_hdrs + i) < 0){
@@ -167,6 +167,9 @@ void process_dd_pkt(interface_data *iface, neighbor *nbr, const ospf_header *osp
    Description packet from the master after this interval will
    generate a SeqNumberMismatch neighbor event. */
 
+void take_db_summary(const interface_data *iface, neighbor *nbr);
+void release_db_snapshot(db_snapshot *s);
+int refresh_db_summary(area *a, int pos, const ospf_lsa_header *lsa_hdr);
 void encapsulate_dd_pkt(const interface_data *iface, neighbor *nbr, ospf_header *ospf_hdr);
 
 #endif
@@ -0,0 +1,158 @@
+#include "hash.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned int hash_slot(const hash_index *h, uint64_t key){
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return (unsigned int)key & (h->size - 1);
+}
+
+uint64_t hash_mix(uint64_t h, uint64_t v){
+	h ^= v;
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+uint64_t hash_bytes(const void *data, size_t len){
+	const uint8_t *p = data;
+	uint64_t h = hash_mix(0, len);
+	for(; len >= sizeof(uint64_t); p += sizeof(uint64_t), len -= sizeof(uint64_t)){
+		uint64_t v;
+		memcpy(&v, p, sizeof(uint64_t));
+		h = hash_mix(h, v);
+	}
+	if(len > 0){
+		uint64_t v = 0;
+		memcpy(&v, p, len);
+		h = hash_mix(h, v);
+	}
+	return h;
+}
+
+void hash_index_init(hash_index *h, int capacity){
+	int size = 16;
+	while(size < capacity * 2){
+		size <<= 1;
+	}
+	h->size = size;
+	h->count = 0;
+	h->keys = malloc(size * sizeof(uint64_t));
+	h->vals = malloc(size * sizeof(int));
+	memset(h->vals, 0xff, size * sizeof(int));
+}
+
+void hash_index_clear(hash_index *h){
+	if(h->size == 0){
+		hash_index_init(h, 0);
+		return ;
+	}
+	h->count = 0;
+	memset(h->vals, 0xff, h->size * sizeof(int));
+}
+
+void hash_index_free(hash_index *h){
+	free(h->keys);
+	free(h->vals);
+	h->keys = NULL;
+	h->vals = NULL;
+	h->size = 0;
+	h->count = 0;
+}
+
+int hash_index_get(const hash_index *h, uint64_t key){
+	if(h->size == 0){
+		return -1;
+	}
+	for(unsigned int i = hash_slot(h, key); h->vals[i] != -1; i = (i + 1) & (h->size - 1)){
+		if(h->keys[i] == key){
+			return h->vals[i];
+		}
+	}
+	return -1;
+}
+
+static void hash_index_grow(hash_index *h){
+	hash_index old = *h;
+	hash_index_init(h, old.size);
+	for(int i = 0; i < old.size; i++){
+		if(old.vals[i] != -1){
+			hash_index_put(h, old.keys[i], old.vals[i]);
+		}
+	}
+	hash_index_free(&old);
+}
+
+void hash_index_put(hash_index *h, uint64_t key, int val){
+	if(h->size == 0){
+		hash_index_init(h, 0);
+	}
+	if((h->count + 1) * 2 > h->size){
+		hash_index_grow(h);
+	}
+	unsigned int i;
+	for(i = hash_slot(h, key); h->vals[i] != -1; i = (i + 1) & (h->size - 1)){
+		if(h->keys[i] == key){
+			h->vals[i] = val;
+			return ;
+		}
+	}
+	h->keys[i] = key;
+	h->vals[i] = val;
+	h->count++;
+}
+
+/* backward shift deletion, so that lookups never need tombstones */
+void hash_index_del(hash_index *h, uint64_t key){
+	if(h->size == 0){
+		return ;
+	}
+	unsigned int mask = h->size - 1;
+	unsigned int i;
+	for(i = hash_slot(h, key); h->vals[i] != -1; i = (i + 1) & mask){
+		if(h->keys[i] == key){
+			break;
+		}
+	}
+	if(h->vals[i] == -1){
+		return ;
+	}
+	h->count--;
+	for(unsigned int j = (i + 1) & mask; h->vals[j] != -1; j = (j + 1) & mask){
+		unsigned int k = hash_slot(h, h->keys[j]);
+		/* move the entry at j into the hole at i unless its home slot
+		   lies cyclically in (i, j] */
+		if((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))){
+			h->keys[i] = h->keys[j];
+			h->vals[i] = h->vals[j];
+			i = j;
+		}
+	}
+	h->vals[i] = -1;
+}
+
+void key_set_add(key_set *s, uint64_t key){
+	if(hash_index_get(&s->index, key) != -1){
+		return ;
+	}
+	if(s->num == s->max){
+		s->max = s->max ? s->max * 2 : 16;
+		s->keys = realloc(s->keys, s->max * sizeof(uint64_t));
+	}
+	hash_index_put(&s->index, key, s->num);
+	s->keys[s->num++] = key;
+}
+
+void key_set_clear(key_set *s){
+	if(s->num == 0){
+		return ;
+	}
+	s->num = 0;
+	hash_index_clear(&s->index);
+}
@@ -0,0 +1,49 @@
+#ifndef _HASH_H
+#define _HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* An open addressing hash index from a 64-bit key to a non-negative
+   integer, usually the position of an entry in some array. It is used
+   wherever the protocol has to find an object by its identity (a
+   vertex by its type and Vertex ID, an LSA by its type, Link State ID
+   and Advertising Router, ...) and a linear scan would make the
+   calculation quadratic. The table grows as entries are added. */
+typedef struct hash_index{
+	int size;
+	int count;
+	uint64_t *keys;
+	/* -1 marks an empty slot */
+	int *vals;
+}hash_index;
+
+/* combine an LSA type with a 32-bit identifier */
+#define HASH_KEY(type, id) (((uint64_t)(type) << 32) | (uint32_t)(id))
+
+/* fold v into the running hash h */
+uint64_t hash_mix(uint64_t h, uint64_t v);
+/* hash of len bytes of data */
+uint64_t hash_bytes(const void *data, size_t len);
+
+void hash_index_init(hash_index *h, int capacity);
+void hash_index_clear(hash_index *h);
+void hash_index_free(hash_index *h);
+int hash_index_get(const hash_index *h, uint64_t key);
+void hash_index_put(hash_index *h, uint64_t key, int val);
+void hash_index_del(hash_index *h, uint64_t key);
+
+/* A set of keys that remembers the order they were added in, for
+   collecting what has changed in the database between two routing
+   table calculations. */
+typedef struct key_set{
+	int num;
+	int max;
+	uint64_t *keys;
+	hash_index index;
+}key_set;
+
+void key_set_add(key_set *s, uint64_t key);
+void key_set_clear(key_set *s);
+
+#endif
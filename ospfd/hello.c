@@ -60,6 +60,8 @@ void process_hello_pkt(interface_data *iface, neighbor *nbr, const ospf_header *
 	/* create a new neighbor node in neighbors list */
 	if(!nbr){
 		nbr = neighbor_init(hello, ospf_hdr->router_id, src);
+		/* until the round-trip time is measured */
+		nbr->rto = iface->rxmt_interval * 1000;
 		/* add new neighbor struct to interface neighbors */
 		nbr->next = iface->neighbors;
 		iface->neighbors = nbr;
@@ -1,6 +1,7 @@
 #include "interface.h"
 #include "ospfd.h"
 #include <sys/ioctl.h>
+#include <netinet/ip.h>
 #include <arpa/inet.h>
 #include <net/ethernet.h>
 #include <stdio.h>
@@ -55,6 +56,16 @@ int interface_init(){
 			}
 			ifs[num_if].network_mask = ((struct sockaddr_in *)&ifrs[i].ifr_netmask)->sin_addr.s_addr;
 
+			/* interface MTU, no larger than the packet buffers */
+			ret = ioctl(sock, SIOCGIFMTU, ifrs + i);
+			if(ret == FAILURE){
+				printf("Warning: Can not get MTU of interface %s, assume %d.\n", ifrs[i].ifr_name, DEFAULT_MTU);
+				ifs[num_if].mtu = DEFAULT_MTU;
+			}
+			else{
+				ifs[num_if].mtu = (ifrs[i].ifr_mtu < BUFFER_SIZE) ? ifrs[i].ifr_mtu : BUFFER_SIZE;
+			}
+
 			/* turn on promisc mode */
 			ret = ioctl(sock, SIOCGIFFLAGS, ifrs + i);
 			if(ret == FAILURE){
@@ -85,6 +96,11 @@ int interface_init(){
 		    ifs[num_if].bd_router = 0;
 		    ifs[num_if].rxmt_interval =  OSPF_DEFAULT_RXMT_INTERVAL;
             ifs[num_if].rxmt_timer = 0;
+		    memset(&ifs[num_if].delayed_acks, 0, sizeof(lsa_list));
+		    ifs[num_if].ack_delay = OSPF_DEFAULT_ACK_DELAY;
+		    ifs[num_if].ack_timer = 0;
+		    memset(&ifs[num_if].flood_queue, 0, sizeof(lsa_list));
+		    ifs[num_if].flood_due = 0;
 		    ifs[num_if].cost = htons(5);
 		    num_if++;
 		}
@@ -105,3 +121,11 @@ const char *lookup_ifname_by_ip(const area *a, in_addr_t ip){
 	}
 	return 0;
 }
+
+/* the largest OSPF packet, IP header excluded, that is built for iface:
+   one that fills an IP datagram of the interface MTU, or the send
+   buffer if that is smaller */
+int ospf_packet_size(const interface_data *iface){
+	int size = (iface->mtu < BUFFER_SIZE) ? iface->mtu : BUFFER_SIZE;
+	return size - sizeof(struct iphdr);
+}
@@ -2,6 +2,7 @@
 #define _INTERFACE_H
 
 #include "neighbor.h"
+#include "lsa_list.h"
 #include "area.h"
 #include "shared.h"
 
@@ -53,6 +54,12 @@ typedef struct interface_data{
        the interface are labelled with this Area ID. */
 	uint32_t area_id;
 
+	/* Interface MTU - the size in bytes of the largest IP datagram
+	   that can be sent out the interface without fragmentation. It is
+	   advertised in Database Description packets, and no OSPF packet
+	   built for the interface is larger. */
+	int mtu;
+
 	/* HelloInterval - The length of time, in seconds, between
        the Hello packets that the router sends on the interface.
        Advertised in Hello packets sent out this interface. */
@@ -124,6 +131,23 @@ typedef struct interface_data{
 	int rxmt_interval;
         int rxmt_timer;
 
+	/* 13.5. Sending Link State Acknowledgment packets */
+	/* Delayed acknowledgments, collected from all the neighbors on the
+	   interface and sent together in one multicast packet when
+	   ack_timer reaches ack_delay seconds; the delay is shorter than
+	   RxmtInterval, so that the neighbors do not retransmit. */
+	lsa_list delayed_acks;
+	int ack_delay;
+	int ack_timer;
+
+	/* 13.3. Next step in the flooding procedure */
+	/* The LSAs to be flooded out the interface, sent together in
+	   Link State Update packets once flood_due (see monotonic_ms())
+	   has passed, so that a burst of new LSAs goes out in a few
+	   packets rather than one each. */
+	lsa_list flood_queue;
+	int64_t flood_due;
+
 	/* AuType */
 	/* The type of authentication used on the attached network/subnet.
        Authentication types are defined in Appendix D. All OSPF packet
@@ -151,5 +175,6 @@ typedef struct interface_data{
 int interface_init();
 void set_interface_area(interface_data *iface, uint32_t area_id);
 const char *lookup_ifname_by_ip(const struct area *a, in_addr_t ip);
+int ospf_packet_size(const interface_data *iface);
 
 #endif
@@ -1,5 +1,8 @@
 #include "lsa.h"
+#include "dd.h"
+#include "spf.h"
 #include "ospfd.h"
+#include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -38,67 +41,436 @@ int lsa_hdr_eql(const ospf_lsa_header *a, const ospf_lsa_header *b){
 	return a->ls_type == b->ls_type && a->link_state_id == b->link_state_id && a->adv_router == b->adv_router;
 }
 
-ospf_lsa_header *lookup_lsa(const area *a, const ospf_lsa_header *lsa_hdr){
-	for(int i = 0; i < a->num_lsa; i++){
-		if(lsa_hdr_eql(a->lsas[i], lsa_hdr)){
-			return a->lsas[i];
+/* the first LSA of the given LS type and Link State ID, -1 if none;
+   the others follow through a->lsa_next[] */
+int lookup_lsa_first(const area *a, uint8_t ls_type, in_addr_t id){
+	return hash_index_get(&a->lsa_index, HASH_KEY(ls_type, id));
+}
+
+static int lookup_lsa_index(const area *a, const ospf_lsa_header *lsa_hdr){
+	int i;
+	for(i = lookup_lsa_first(a, lsa_hdr->ls_type, lsa_hdr->link_state_id); i != -1; i = a->lsa_next[i]){
+		if(a->lsas[i]->adv_router == lsa_hdr->adv_router){
+			break;
 		}
 	}
-	return NULL;
+	return i;
+}
+
+/* the first AS-external-LSA with Link State ID id, -1 if none; the
+   others follow through as_external.lsa_next[] */
+int lookup_external_lsa_first(in_addr_t id){
+	return hash_index_get(&as_external.lsa_index, HASH_KEY(OSPF_AS_EXTERNAL_LSA, id));
+}
+
+static int lookup_external_lsa_index(const ospf_lsa_header *lsa_hdr){
+	int i;
+	for(i = lookup_external_lsa_first(lsa_hdr->link_state_id); i != -1; i = as_external.lsa_next[i]){
+		if(as_external.lsas[i]->adv_router == lsa_hdr->adv_router){
+			break;
+		}
+	}
+	return i;
+}
+
+/* AS-external-LSAs are looked up in the AS-wide database */
+ospf_lsa_header *lookup_lsa(const area *a, const ospf_lsa_header *lsa_hdr){
+	if(lsa_hdr->ls_type == OSPF_AS_EXTERNAL_LSA){
+		int i = lookup_external_lsa_index(lsa_hdr);
+		return (i == -1) ? NULL : as_external.lsas[i];
+	}
+	int i = lookup_lsa_index(a, lsa_hdr);
+	return (i == -1) ? NULL : a->lsas[i];
 }
 
+/* An AS-external-LSA instance and the number of its owners: the AS-wide
+   database while it is the current instance, and every external route
+   calculated from it. */
+typedef struct lsa_instance{
+	int refs;
+	ospf_lsa_header hdr[];
+}lsa_instance;
+
+static lsa_instance *lsa_instance_of(const ospf_lsa_header *lsa_hdr){
+	return (lsa_instance *)((uint8_t *)lsa_hdr - offsetof(lsa_instance, hdr));
+}
+
+static ospf_lsa_header *new_lsa_instance(const ospf_lsa_header *lsa_hdr){
+	size_t len = ntohs(lsa_hdr->length);
+	lsa_instance *inst = malloc(sizeof(lsa_instance) + len);
+	inst->refs = 1;
+	memcpy(inst->hdr, lsa_hdr, len);
+	return inst->hdr;
+}
+
+/* The areas calculate their routes in parallel, so the counts are
+   changed atomically. */
+void hold_lsa(const ospf_lsa_header *lsa_hdr){
+	__atomic_add_fetch(&lsa_instance_of(lsa_hdr)->refs, 1, __ATOMIC_RELAXED);
+}
+
+void release_lsa(const ospf_lsa_header *lsa_hdr){
+	lsa_instance *inst = lsa_instance_of(lsa_hdr);
+	if(__atomic_sub_fetch(&inst->refs, 1, __ATOMIC_ACQ_REL) == 0){
+		free(inst);
+	}
+}
+
+/* 13.1. Determining which LSA is newer */
 /* return value < 0: b is newer, > 0: a is newer , = 0: the same */
 int cmp_lsa_hdr(const ospf_lsa_header *a, const ospf_lsa_header *b){
-	return -1;
+	/* LS sequence numbers are signed 32-bit integers */
 	if(a->ls_seqnum != b->ls_seqnum){
-		return ntohl(a->ls_seqnum) - ntohl(b->ls_seqnum);
+		return ((int32_t)ntohl(a->ls_seqnum) > (int32_t)ntohl(b->ls_seqnum)) ? +1 : -1;
 	}
 	else if(a->ls_chksum != b->ls_chksum){
 		return ntohs(a->ls_chksum) - ntohs(b->ls_chksum);
 	}
-	else if(ntohs(a->ls_age) == MAX_AGE){
-		return +1;
-	}
-	else if(ntohs(b->ls_age) == MAX_AGE){
-		return -1;
+	else if((ntohs(a->ls_age) >= MAX_AGE) != (ntohs(b->ls_age) >= MAX_AGE)){
+		return (ntohs(a->ls_age) >= MAX_AGE) ? +1 : -1;
 	}
-	else if(abs(ntohs(a->ls_age) - ntohs(b->ls_age)) < MAX_AGE_DIFF){
+	/* ages closer than MaxAgeDiff are taken to be the same instance */
+	else if(abs(ntohs(a->ls_age) - ntohs(b->ls_age)) > MAX_AGE_DIFF){
 		return ntohs(b->ls_age) - ntohs(a->ls_age);
 	}
 	return 0;
 }
 
 void add_lsa_hdr(neighbor *nbr, const ospf_lsa_header *lsa_hdr){
-	for(int i = 0; i < nbr->num_lsa_hdr; i++){
-		if(lsa_hdr_eql(&nbr->lsa_hdrs[i], lsa_hdr)){
-			if(cmp_lsa_hdr(&nbr->lsa_hdrs[i], lsa_hdr) < 0){
-				nbr->lsa_hdrs[i] = *lsa_hdr;
+	ospf_lsa_header *old = lsa_list_lookup(&nbr->lsa_hdrs, lsa_hdr);
+	if(old == NULL){
+		lsa_list_add(&nbr->lsa_hdrs, lsa_hdr);
+	}
+	else if(cmp_lsa_hdr(old, lsa_hdr) < 0){
+		*old = *lsa_hdr;
+	}
+}
+
+lsa_vec *lookup_lsa_vec(const area *a, uint8_t ls_type, in_addr_t id){
+	for(int i = lookup_lsa_first(a, ls_type, id); i != -1; i = a->lsa_next[i]){
+		if(a->vecs[i] != NULL){
+			return a->vecs[i];
+		}
+	}
+	return NULL;
+}
+
+/* decode a router-LSA or network-LSA into host order, NULL for other types */
+static lsa_vec *decode_lsa(const ospf_lsa_header *lsa_hdr){
+	size_t len = ntohs(lsa_hdr->length);
+	const uint8_t *end = (const uint8_t *)lsa_hdr + len;
+	lsa_vec *vec;
+
+	if(lsa_hdr->ls_type == OSPF_ROUTER_LSA){
+		const router_lsa *rtr_lsa = (const router_lsa *)((const uint8_t *)lsa_hdr + sizeof(ospf_lsa_header));
+		int num = 0;
+		if(len >= sizeof(ospf_lsa_header) + sizeof(router_lsa)){
+			num = ntohs(rtr_lsa->num_link);
+		}
+		vec = malloc(sizeof(lsa_vec) + num * sizeof(spf_link));
+		vec->flags = (len >= sizeof(ospf_lsa_header) + sizeof(router_lsa)) ? rtr_lsa->flags : 0;
+		vec->network_mask = 0;
+		vec->num_link = 0;
+		/* links carrying TOS metrics are longer than a bare mylink */
+		for(const uint8_t *p = (const uint8_t *)rtr_lsa->links; num-- && p + sizeof(mylink) <= end; ){
+			const mylink *lnk = (const mylink *)p;
+			spf_link *l = &vec->links[vec->num_link++];
+			l->id = lnk->id;
+			l->data = lnk->data;
+			l->type = lnk->type;
+			l->metric = ntohs(lnk->metric);
+			l->back_link = OSPFD_FALSE;
+			p += sizeof(mylink) + lnk->num_diff_tos * sizeof(router_lsa_tos);
+		}
+	}
+	else if(lsa_hdr->ls_type == OSPF_NETWORK_LSA){
+		const network_lsa *net_lsa = (const network_lsa *)((const uint8_t *)lsa_hdr + sizeof(ospf_lsa_header));
+		int num = 0;
+		if(len >= sizeof(ospf_lsa_header) + sizeof(network_lsa)){
+			num = (len - sizeof(ospf_lsa_header) - sizeof(network_lsa)) / sizeof(in_addr_t);
+		}
+		vec = malloc(sizeof(lsa_vec) + num * sizeof(spf_link));
+		vec->flags = 0;
+		vec->network_mask = num ? net_lsa->network_mask : 0;
+		vec->num_link = num;
+		for(int i = 0; i < num; i++){
+			vec->links[i].id = net_lsa->attached_rtrs[i];
+			vec->links[i].data = 0;
+			vec->links[i].type = RTR_LSA_ROUTER;
+			vec->links[i].metric = 0;
+			vec->links[i].back_link = OSPFD_FALSE;
+		}
+	}
+	else{
+		return NULL;
+	}
+	vec->ls_type = lsa_hdr->ls_type;
+	vec->id = lsa_hdr->link_state_id;
+	return vec;
+}
+
+/* find the link of vertex 'to' that points back at vertex 'from' */
+static const spf_link *lookup_back_link(const lsa_vec *to, const lsa_vec *from){
+	for(const spf_link *l = to->links; l < to->links + to->num_link; l++){
+		if(from->ls_type == OSPF_ROUTER_LSA){
+			if(l->type == RTR_LSA_ROUTER && l->id == from->id){
+				return l;
+			}
+		}
+		else{
+			if(l->type == RTR_LSA_TRANSIT && l->id == from->id){
+				return l;
 			}
-			return;
 		}
 	}
-	nbr->lsa_hdrs[nbr->num_lsa_hdr++] = *lsa_hdr;
+	return NULL;
 }
 
-ospf_lsa_header *install_lsa(area *a, const ospf_lsa_header *lsa_hdr){
-	int i;
-	for(i = 0; i < a->num_lsa; i++){
-		if(lsa_hdr_eql(a->lsas[i], lsa_hdr)){
-			if(cmp_lsa_hdr(a->lsas[i], lsa_hdr) < 0){
-				break;
+static void resolve_link(const area *a, const lsa_vec *vec, spf_link *lnk){
+	const lsa_vec *to = NULL;
+	const spf_link *back = NULL;
+	if(lnk->type == RTR_LSA_ROUTER){
+		to = lookup_lsa_vec(a, OSPF_ROUTER_LSA, lnk->id);
+	}
+	else if(lnk->type == RTR_LSA_TRANSIT){
+		to = lookup_lsa_vec(a, OSPF_NETWORK_LSA, lnk->id);
+	}
+	if(to != NULL){
+		back = lookup_back_link(to, vec);
+	}
+	lnk->back_link = (back != NULL);
+	/* the network-LSA carries no metrics, use the attached router's */
+	if(vec->ls_type == OSPF_NETWORK_LSA){
+		lnk->metric = back ? back->metric : 0;
+	}
+}
+
+/* the vertex a link points at, 0 for a stub network */
+static uint64_t link_target(const spf_link *lnk){
+	if(lnk->type == RTR_LSA_ROUTER){
+		return HASH_KEY(OSPF_ROUTER_LSA, lnk->id);
+	}
+	if(lnk->type == RTR_LSA_TRANSIT){
+		return HASH_KEY(OSPF_NETWORK_LSA, lnk->id);
+	}
+	return 0;
+}
+
+/* note that the LSA at lsas[i] points at vertex key */
+static void add_lsa_ref(area *a, uint64_t key, int i){
+	int first = hash_index_get(&a->ref_index, key);
+	for(int r = first; r != -1; r = a->ref_next[r]){
+		if(a->ref_lsa[r] == i){
+			return ;
+		}
+	}
+	int r = a->ref_free;
+	if(r != -1){
+		a->ref_free = a->ref_next[r];
+	}
+	else{
+		if(a->num_ref == a->max_ref){
+			a->max_ref = a->max_ref ? a->max_ref * 2 : LIST_MAX;
+			a->ref_lsa = realloc(a->ref_lsa, a->max_ref * sizeof(int));
+			a->ref_next = realloc(a->ref_next, a->max_ref * sizeof(int));
+		}
+		r = a->num_ref++;
+	}
+	a->ref_lsa[r] = i;
+	a->ref_next[r] = first;
+	hash_index_put(&a->ref_index, key, r);
+}
+
+static void del_lsa_ref(area *a, uint64_t key, int i){
+	int prev = -1;
+	int r;
+	for(r = hash_index_get(&a->ref_index, key); r != -1; prev = r, r = a->ref_next[r]){
+		if(a->ref_lsa[r] == i){
+			break;
+		}
+	}
+	if(r == -1){
+		return ;
+	}
+	if(prev != -1){
+		a->ref_next[prev] = a->ref_next[r];
+	}
+	else if(a->ref_next[r] != -1){
+		hash_index_put(&a->ref_index, key, a->ref_next[r]);
+	}
+	else{
+		hash_index_del(&a->ref_index, key);
+	}
+	a->ref_next[r] = a->ref_free;
+	a->ref_free = r;
+}
+
+/* Resolve the back-links of the LSA newly decoded at lsas[i], which
+   replaces old_vec, and of the links of the other LSAs that point at
+   it, found through the reverse index. */
+static void link_lsa_vec(area *a, int i, const lsa_vec *old_vec){
+	lsa_vec *vec = a->vecs[i];
+	uint8_t type = (vec->ls_type == OSPF_ROUTER_LSA) ? RTR_LSA_ROUTER : RTR_LSA_TRANSIT;
+	if(old_vec != NULL){
+		for(int j = 0; j < old_vec->num_link; j++){
+			if(link_target(&old_vec->links[j]) != 0){
+				del_lsa_ref(a, link_target(&old_vec->links[j]), i);
 			}
-			else{
-				return NULL;
+		}
+	}
+	for(int j = 0; j < vec->num_link; j++){
+		resolve_link(a, vec, &vec->links[j]);
+		if(link_target(&vec->links[j]) != 0){
+			add_lsa_ref(a, link_target(&vec->links[j]), i);
+		}
+	}
+	key_set_add(&a->graph_dirty, HASH_KEY(vec->ls_type, vec->id));
+	for(int r = hash_index_get(&a->ref_index, HASH_KEY(vec->ls_type, vec->id)); r != -1; r = a->ref_next[r]){
+		lsa_vec *other = a->vecs[a->ref_lsa[r]];
+		if(other == NULL || other == vec){
+			continue;
+		}
+		for(int j = 0; j < other->num_link; j++){
+			if(other->links[j].type == type && other->links[j].id == vec->id){
+				resolve_link(a, other, &other->links[j]);
+				key_set_add(&a->graph_dirty, HASH_KEY(other->ls_type, other->id));
+			}
+		}
+	}
+}
+
+/* What a decoded LSA adds to the area's topology fingerprint. The
+   metrics of network-LSA links are left out, as they are copied from
+   the attached routers' links when the back-links are resolved. */
+static uint64_t lsa_vec_hash(const lsa_vec *vec){
+	if(vec == NULL){
+		return 0;
+	}
+	uint64_t h = hash_mix(HASH_KEY(vec->ls_type, vec->id), vec->network_mask);
+	for(const spf_link *lnk = vec->links; lnk < vec->links + vec->num_link; lnk++){
+		h = hash_mix(h, ((uint64_t)lnk->id << 32) | lnk->data);
+		h = hash_mix(h, ((uint64_t)lnk->type << 16) |
+			(vec->ls_type == OSPF_ROUTER_LSA ? lnk->metric : 0));
+	}
+	return h;
+}
+
+/* hash of the body of an LSA, everything after the LSA header */
+static uint64_t lsa_body_hash(const ospf_lsa_header *lsa_hdr){
+	size_t len = ntohs(lsa_hdr->length);
+	return hash_bytes((const uint8_t *)lsa_hdr + sizeof(ospf_lsa_header),
+		(len > sizeof(ospf_lsa_header)) ? len - sizeof(ospf_lsa_header) : 0);
+}
+
+/* A new instance whose body is the same as the installed one only
+   refreshes the header (sequence number, age and checksum). It
+   replaces the old one in place, without touching the routing
+   table, unless it is being flushed (MaxAge). */
+static int lsa_refreshes(const ospf_lsa_header *old, uint64_t old_hash, const ospf_lsa_header *lsa_hdr, uint64_t hash){
+	size_t len = ntohs(lsa_hdr->length);
+	size_t body_len = (len > sizeof(ospf_lsa_header)) ? len - sizeof(ospf_lsa_header) : 0;
+	return old_hash == hash && ntohs(old->length) == len &&
+		memcmp((const uint8_t *)old + sizeof(ospf_lsa_header), (const uint8_t *)lsa_hdr + sizeof(ospf_lsa_header),
+			body_len) == 0 &&
+		(ntohs(old->ls_age) == MAX_AGE) == (ntohs(lsa_hdr->ls_age) == MAX_AGE);
+}
+
+static void reserve_external_lsas(int num){
+	external_lsdb *db = &as_external;
+	if(num <= db->max_lsa){
+		return ;
+	}
+	int max = db->max_lsa ? db->max_lsa : LIST_MAX;
+	while(max < num){
+		max *= 2;
+	}
+	db->lsas = realloc(db->lsas, max * sizeof(ospf_lsa_header *));
+	db->lsa_next = realloc(db->lsa_next, max * sizeof(int));
+	db->lsa_hash = realloc(db->lsa_hash, max * sizeof(uint64_t));
+	db->max_lsa = max;
+}
+
+/* An AS-external-LSA is installed once for the whole AS, and every
+   non-stub area calculates the route to its destination again. */
+static ospf_lsa_header *install_external_lsa(const ospf_lsa_header *lsa_hdr){
+	external_lsdb *db = &as_external;
+	int i = lookup_external_lsa_index(lsa_hdr);
+	if(i != -1 && cmp_lsa_hdr(db->lsas[i], lsa_hdr) >= 0){
+		return NULL;
+	}
+	uint64_t hash = lsa_body_hash(lsa_hdr);
+	if(i != -1 && lsa_refreshes(db->lsas[i], db->lsa_hash[i], lsa_hdr, hash)){
+		memcpy(db->lsas[i], lsa_hdr, sizeof(ospf_lsa_header));
+		/* the snapshots of the areas are kept (see refresh_db_summary()) */
+		for(int j = 0; j < num_area; j++){
+			if(areas[j].external_routing_capability &&
+				!refresh_db_summary(&areas[j], areas[j].num_lsa + i, db->lsas[i])){
+				db->version++;
+				break;
 			}
 		}
+		return db->lsas[i];
+	}
+	db->version++;
+	if(i == -1){
+		uint64_t key = HASH_KEY(lsa_hdr->ls_type, lsa_hdr->link_state_id);
+		i = db->num_lsa++;
+		reserve_external_lsas(i + 1);
+		db->lsa_next[i] = hash_index_get(&db->lsa_index, key);
+		hash_index_put(&db->lsa_index, key, i);
+	}
+	else{
+		/* the routes still using the old instance keep it */
+		release_lsa(db->lsas[i]);
+	}
+	db->lsas[i] = new_lsa_instance(lsa_hdr);
+	db->lsa_hash[i] = hash;
+	for(int j = 0; j < num_area; j++){
+		if(areas[j].external_routing_capability){
+			spf_note_change(&areas[j], db->lsas[i], NULL, NULL);
+		}
+	}
+	return db->lsas[i];
+}
+
+ospf_lsa_header *install_lsa(area *a, const ospf_lsa_header *lsa_hdr){
+	/* AS-external-LSAs are not flooded into stub areas (Section 3.6) */
+	if(lsa_hdr->ls_type == OSPF_AS_EXTERNAL_LSA){
+		return a->external_routing_capability ? install_external_lsa(lsa_hdr) : NULL;
+	}
+	int i = lookup_lsa_index(a, lsa_hdr);
+	if(i != -1 && cmp_lsa_hdr(a->lsas[i], lsa_hdr) >= 0){
+		return NULL;
 	}
 	size_t len = ntohs(lsa_hdr->length);
+	uint64_t hash = lsa_body_hash(lsa_hdr);
+	if(i != -1 && lsa_refreshes(a->lsas[i], a->lsa_hash[i], lsa_hdr, hash)){
+		memcpy(a->lsas[i], lsa_hdr, sizeof(ospf_lsa_header));
+		/* the snapshot is kept (see refresh_db_summary()) */
+		if(!refresh_db_summary(a, i, a->lsas[i])){
+			a->lsdb_version++;
+		}
+		return a->lsas[i];
+	}
+	a->lsdb_version++;
+	if(i == -1){
+		uint64_t key = HASH_KEY(lsa_hdr->ls_type, lsa_hdr->link_state_id);
+		i = a->num_lsa++;
+		area_reserve_lsas(a, i + 1);
+		a->lsa_next[i] = hash_index_get(&a->lsa_index, key);
+		hash_index_put(&a->lsa_index, key, i);
+	}
 	a->lsas[i] = realloc(a->lsas[i], len);
 	memcpy(a->lsas[i], lsa_hdr, len);
-	if(i == a->num_lsa){
-		a->num_lsa += 1;
+	a->lsa_hash[i] = hash;
+	lsa_vec *old_vec = a->vecs[i];
+	a->vecs[i] = decode_lsa(a->lsas[i]);
+	a->topo_hash += lsa_vec_hash(a->vecs[i]) - lsa_vec_hash(old_vec);
+	if(a->vecs[i] != NULL){
+		link_lsa_vec(a, i, old_vec);
 	}
-	// a->num_lsa += (i == a->num_lsa);
+	spf_note_change(a, a->lsas[i], old_vec, a->vecs[i]);
+	free(old_vec);
 	return a->lsas[i];
 }
 
@@ -177,7 +549,6 @@ ospf_lsa_header *originate_router_lsa(area *a){
 	lsa_hdr->ls_type = OSPF_ROUTER_LSA;
 	lsa_hdr->link_state_id = my_router_id;
 	lsa_hdr->adv_router = my_router_id;
-	lsa_hdr->ls_seqnum = get_ls_seqnum();
 	
     /* encapsulate body of Router_LSA */
 	rtr_lsa->flags = 0x00;
@@ -214,11 +585,23 @@ ospf_lsa_header *originate_router_lsa(area *a){
 		}
 	}
 	rtr_lsa->num_link = htons((lnk - rtr_lsa->links));
-	size_t len = sizeof(ospf_lsa_header) + sizeof(router_lsa) + (lnk - rtr_lsa->links) * sizeof(link);
+	size_t len = sizeof(ospf_lsa_header) + sizeof(router_lsa) + (lnk - rtr_lsa->links) * sizeof(mylink);
 	lsa_hdr->length = htons(len);
+
+	/* A router-LSA whose contents have not changed is not originated
+	   again until it is LSRefreshTime old (event (1) above). */
+	const ospf_lsa_header *old = lookup_lsa(a, lsa_hdr);
+	int64_t now = monotonic_ms();
+	if(old != NULL && ntohs(old->length) == len &&
+		memcmp((const uint8_t *)old + sizeof(ospf_lsa_header), rtr_lsa, len - sizeof(ospf_lsa_header)) == 0 &&
+		now - a->router_lsa_time < LS_REFRESH_TIME * 1000LL){
+		return NULL;
+	}
+	lsa_hdr->ls_seqnum = get_ls_seqnum();
 	lsa_hdr->ls_chksum = 0;
 	lsa_hdr->ls_chksum = htons(fletcher16(buff + sizeof(lsa_hdr->ls_age),
 		ntohs(lsa_hdr->length) - sizeof(lsa_hdr->ls_age)));
+	a->router_lsa_time = now;
 	return install_lsa(a, lsa_hdr);
 }
 
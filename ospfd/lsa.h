@@ -163,9 +163,14 @@
 
 uint16_t fletcher16(const uint8_t *data, size_t len);
 int lsa_hdr_eql(const ospf_lsa_header *a, const ospf_lsa_header *b);
+int lookup_lsa_first(const area *a, uint8_t ls_type, in_addr_t id);
+int lookup_external_lsa_first(in_addr_t id);
 ospf_lsa_header *lookup_lsa(const area *a, const ospf_lsa_header *lsa_hdr);
+void hold_lsa(const ospf_lsa_header *lsa_hdr);
+void release_lsa(const ospf_lsa_header *lsa_hdr);
 int cmp_lsa_hdr(const ospf_lsa_header *a, const ospf_lsa_header *b);
 void add_lsa_hdr(neighbor *nbr, const ospf_lsa_header *lsa_hdr);
+lsa_vec *lookup_lsa_vec(const area *a, uint8_t ls_type, in_addr_t id);
 ospf_lsa_header *install_lsa(area *a, const ospf_lsa_header *lsa_hdr);
 int32_t get_ls_seqnum();
 ospf_lsa_header *originate_router_lsa(area *a);
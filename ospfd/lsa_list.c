@@ -0,0 +1,123 @@
+#include "lsa_list.h"
+#include "shared.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static int lsa_list_index(const lsa_list *l, const ospf_lsa_header *lsa_hdr){
+	int i;
+	for(i = hash_index_get(&l->index, HASH_KEY(lsa_hdr->ls_type, lsa_hdr->link_state_id)); i != -1; i = l->next[i]){
+		if(l->lsas[i].adv_router == lsa_hdr->adv_router){
+			break;
+		}
+	}
+	return i;
+}
+
+ospf_lsa_header *lsa_list_lookup(const lsa_list *l, const ospf_lsa_header *lsa_hdr){
+	int i = lsa_list_index(l, lsa_hdr);
+	return (i == -1) ? NULL : &l->lsas[i];
+}
+
+/* the entry of the LSA, added as a copy of lsa_hdr if there is none;
+   it stays valid until the list is changed again */
+ospf_lsa_header *lsa_list_add(lsa_list *l, const ospf_lsa_header *lsa_hdr){
+	int i = lsa_list_index(l, lsa_hdr);
+	if(i != -1){
+		return &l->lsas[i];
+	}
+	if(l->len == l->max){
+		l->max = l->max ? l->max * 2 : LIST_MAX;
+		l->lsas = realloc(l->lsas, l->max * sizeof(ospf_lsa_header));
+		l->time = realloc(l->time, l->max * sizeof(int64_t));
+		l->sends = realloc(l->sends, l->max * sizeof(int));
+		l->next = realloc(l->next, l->max * sizeof(int));
+	}
+	uint64_t key = HASH_KEY(lsa_hdr->ls_type, lsa_hdr->link_state_id);
+	i = l->len++;
+	if(l->num == 0){
+		l->first = i;
+	}
+	l->lsas[i] = *lsa_hdr;
+	l->time[i] = 0;
+	l->sends[i] = 0;
+	l->next[i] = hash_index_get(&l->index, key);
+	hash_index_put(&l->index, key, i);
+	l->num++;
+	return &l->lsas[i];
+}
+
+/* squeeze out the removed slots, keeping the order of the others */
+static void lsa_list_compact(lsa_list *l){
+	int n = 0;
+	hash_index_clear(&l->index);
+	for(int i = 0; i < l->len; i++){
+		if(l->lsas[i].ls_type == 0){
+			continue;
+		}
+		uint64_t key = HASH_KEY(l->lsas[i].ls_type, l->lsas[i].link_state_id);
+		l->lsas[n] = l->lsas[i];
+		l->time[n] = l->time[i];
+		l->sends[n] = l->sends[i];
+		l->next[n] = hash_index_get(&l->index, key);
+		hash_index_put(&l->index, key, n);
+		n++;
+	}
+	l->len = n;
+	l->first = 0;
+}
+
+/* OSPFD_TRUE if the LSA was in the list */
+int lsa_list_del(lsa_list *l, const ospf_lsa_header *lsa_hdr){
+	int i = lsa_list_index(l, lsa_hdr);
+	if(i == -1){
+		return OSPFD_FALSE;
+	}
+	uint64_t key = HASH_KEY(lsa_hdr->ls_type, lsa_hdr->link_state_id);
+	int head = hash_index_get(&l->index, key);
+	if(head == i){
+		if(l->next[i] == -1){
+			hash_index_del(&l->index, key);
+		}
+		else{
+			hash_index_put(&l->index, key, l->next[i]);
+		}
+	}
+	else{
+		int p = head;
+		while(l->next[p] != i){
+			p = l->next[p];
+		}
+		l->next[p] = l->next[i];
+	}
+	l->lsas[i].ls_type = 0;
+	l->num--;
+	while(l->first < l->len && l->lsas[l->first].ls_type == 0){
+		l->first++;
+	}
+	if(l->num == 0){
+		lsa_list_clear(l);
+	}
+	else if(l->len > LIST_MAX && l->num < l->len / 2){
+		lsa_list_compact(l);
+	}
+	return OSPFD_TRUE;
+}
+
+void lsa_list_clear(lsa_list *l){
+	l->num = 0;
+	l->len = 0;
+	l->first = 0;
+	if(l->index.size > 0){
+		hash_index_clear(&l->index);
+	}
+}
+
+void lsa_list_free(lsa_list *l){
+	free(l->lsas);
+	free(l->time);
+	free(l->sends);
+	free(l->next);
+	hash_index_free(&l->index);
+	memset(l, 0, sizeof(lsa_list));
+}
@@ -0,0 +1,39 @@
+#ifndef _LSA_LIST_H
+#define _LSA_LIST_H
+
+#include <stdint.h>
+
+#include "ospf_packets.h"
+#include "hash.h"
+
+/* A list of LSAs kept for a neighbor or an interface, identified by LS
+   type, Link State ID and Advertising Router. The entries keep the
+   order they were added in; a removed entry leaves its slot behind with ls_type 0 until the
+   list is compacted. The entries sharing an LS type and Link State ID
+   are chained through next[] (-1 ends the chain), starting from the
+   entry of index for HASH_KEY(LS type, Link State ID), so adding,
+   finding and removing an LSA take constant time. */
+typedef struct lsa_list{
+	/* entries in the list */
+	int num;
+	/* slots in use, removed ones included */
+	int len;
+	int max;
+	/* the first slot in use that has not been removed, len if none */
+	int first;
+	ospf_lsa_header *lsas;
+	/* a time in milliseconds and a count for each entry, see
+	   add_rxmt_lsa() */
+	int64_t *time;
+	int *sends;
+	int *next;
+	hash_index index;
+}lsa_list;
+
+ospf_lsa_header *lsa_list_lookup(const lsa_list *l, const ospf_lsa_header *lsa_hdr);
+ospf_lsa_header *lsa_list_add(lsa_list *l, const ospf_lsa_header *lsa_hdr);
+int lsa_list_del(lsa_list *l, const ospf_lsa_header *lsa_hdr);
+void lsa_list_clear(lsa_list *l);
+void lsa_list_free(lsa_list *l);
+
+#endif
@@ -1,15 +1,29 @@
 #include "lsack.h"
 
-void encapsulate_lsack_pkt(neighbor *nbr, ospf_header *ospf_hdr){
+/* Acknowledge the LSAs on acks, the direct acknowledgments of a
+   neighbor or the delayed ones of an interface, as many as fit; they
+   are removed from the list, the rest wait for the next packet. */
+void encapsulate_lsack_pkt(const interface_data *iface, lsa_list *acks, ospf_header *ospf_hdr){
 	ospf_lsa_header *lsa_hdr = (ospf_lsa_header *)((uint8_t *)ospf_hdr + sizeof(ospf_header));
+	const ospf_lsa_header *end = (const ospf_lsa_header *)((const uint8_t *)ospf_hdr + ospf_packet_size(iface));
 
-	for(int i = 0; i < nbr->num_lsack; i++){
-		*lsa_hdr++ = nbr->lsacks[i];
+	int i;
+	for(i = acks->first; i < acks->len && lsa_hdr + 1 <= end; i++){
+		if(acks->lsas[i].ls_type != 0){
+			*lsa_hdr++ = acks->lsas[i];
+		}
 	}
 
 	ospf_hdr->type = MSG_TYPE_LINK_STATE_ACK;
 	ospf_hdr->pktlen = htons((uint8_t*)lsa_hdr - (uint8_t *)ospf_hdr);
-	nbr->num_lsack = 0;
+	if(i == acks->len){
+		lsa_list_clear(acks);
+	}
+	else{
+		for(const ospf_lsa_header *p = (const ospf_lsa_header *)((uint8_t *)ospf_hdr + sizeof(ospf_header)); p < lsa_hdr; p++){
+			lsa_list_del(acks, p);
+		}
+	}
 }
 
 void process_lsack_pkt(neighbor *nbr, ospf_header *ospf_hdr){
@@ -21,19 +35,17 @@ void process_lsack_pkt(neighbor *nbr, ospf_header *ospf_hdr){
 	ospf_lsa_header *lsa_hdr = (ospf_lsa_header *)((uint8_t *)ospf_hdr + sizeof(ospf_header));
 	int num = (ntohs(ospf_hdr->pktlen) - sizeof(ospf_header)) / sizeof(ospf_lsa_header);
 
-	int i = 0;
-	int j = 0;
+	/* 13.7. Receiving link state acknowledgments */
+	/* If the acknowledgment is for the same instance that is contained
+	   on the list, the item is removed from the list and the
+	   retransmission of the LSA stops. Otherwise, the acknowledgment
+	   is questionable and is ignored. */
+	int64_t now = monotonic_ms();
 	while(num--){
-		for(i = 0; i < nbr->num_lsr; i++){
-			if(nbr->lsrs[i].ls_type == lsa_hdr->ls_type && 
-				nbr->lsrs[i].link_state_id == lsa_hdr->link_state_id &&
-				nbr->lsrs[i].adv_router == lsa_hdr->adv_router){
-				nbr->num_lsr -= 1;
-				for(j = i; j < nbr->num_lsr; j++){
-					nbr->lsrs[j] = nbr->lsrs[j+1];
-				}
-				break;
-			}
+		ospf_lsa_header *sent = lsa_list_lookup(&nbr->rxmt, lsa_hdr);
+		if(sent != NULL && sent->ls_seqnum == lsa_hdr->ls_seqnum && sent->ls_chksum == lsa_hdr->ls_chksum){
+			ack_rxmt_lsa(nbr, lsa_hdr, now);
 		}
+		lsa_hdr++;
 	}
 }
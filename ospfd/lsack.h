@@ -110,7 +110,7 @@ are in states Exchange
 or Loading (see
 Section 13, step 4).                                                     */
 
-void encapsulate_lsack_pkt(neighbor *nbr, ospf_header *ospf_hdr);
+void encapsulate_lsack_pkt(const interface_data *iface, lsa_list *acks, ospf_header *ospf_hdr);
 
 
 /* 13.7. Receiving link state acknowledgments */
@@ -1,4 +1,5 @@
 #include "lsr.h"
+#include <string.h>
 
 void process_lsr_pkt(interface_data *iface, neighbor *nbr, ospf_header *ospf_hdr){
 	if(nbr->state < NEIGHBOR_STATE_EXCHANGE){
@@ -7,33 +8,37 @@ void process_lsr_pkt(interface_data *iface, neighbor *nbr, ospf_header *ospf_hdr
 	ospf_lsr_pkt *lsr = (ospf_lsr_pkt *)((uint8_t *)ospf_hdr + sizeof(ospf_header));
 	ospf_lsr_pkt *tail = (ospf_lsr_pkt *)((uint8_t *)ospf_hdr + ntohs(ospf_hdr->pktlen));
 
-	int i = 0;
 	while(lsr < tail){
-		for(i = 0; i < nbr->num_lsr; i++){
-			if(lsr->ls_type == (nbr->lsrs+i)->ls_type && 
-				lsr->link_state_id == (nbr->lsrs+i)->link_state_id && 
-				lsr->adv_router == (nbr->lsrs+i)->adv_router){
-				break;
-			}
-		}
-		if(i == nbr->num_lsr){
-			nbr->lsrs[nbr->num_lsr++] = *lsr;
+		ospf_lsa_header key;
+		memset(&key, 0, sizeof(key));
+		key.ls_type = ntohl(lsr->ls_type);
+		key.link_state_id = lsr->link_state_id;
+		key.adv_router = lsr->adv_router;
+		/* LS type 0 marks a removed entry of the list */
+		if(key.ls_type != 0){
+			lsa_list_add(&nbr->lsrs, &key);
 		}
 		lsr++;
 	}
 
-	if(nbr->num_lsa_hdr == 0 && nbr->state == NEIGHBOR_STATE_LOADING){
+	if(nbr->lsa_hdrs.num == 0 && nbr->state == NEIGHBOR_STATE_LOADING){
 		add_neighbor_event(iface, nbr, NEIGHBOR_EV_LOADING_DONE);
 	}
 }
 
-void encapsulate_lsr_pkt(const neighbor *nbr, ospf_header *ospf_hdr){
+void encapsulate_lsr_pkt(const interface_data *iface, const neighbor *nbr, ospf_header *ospf_hdr){
 	ospf_lsr_pkt *lsr = (ospf_lsr_pkt *)((uint8_t *)ospf_hdr + sizeof(ospf_header));
+	const ospf_lsr_pkt *end = (const ospf_lsr_pkt *)((const uint8_t *)ospf_hdr + ospf_packet_size(iface));
 
-	for(int i = 0; i < nbr->num_lsa_hdr; i++){
-		lsr->ls_type = htonl(nbr->lsa_hdrs[i].ls_type);
-		lsr->link_state_id = nbr->lsa_hdrs[i].link_state_id;
-		lsr->adv_router = nbr->lsa_hdrs[i].adv_router;
+	/* the rest of the list is requested once these have arrived */
+	for(int i = nbr->lsa_hdrs.first; i < nbr->lsa_hdrs.len && lsr + 1 <= end; i++){
+		const ospf_lsa_header *lsa_hdr = &nbr->lsa_hdrs.lsas[i];
+		if(lsa_hdr->ls_type == 0){
+			continue;
+		}
+		lsr->ls_type = htonl(lsa_hdr->ls_type);
+		lsr->link_state_id = lsa_hdr->link_state_id;
+		lsr->adv_router = lsa_hdr->adv_router;
 		lsr++;
 	}
 
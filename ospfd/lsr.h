@@ -45,6 +45,6 @@
    neighbor), the Loading Done neighbor event is generated. */
 
 void process_lsr_pkt(interface_data *iface, neighbor *nbr, ospf_header *ospf_hdr);
-void encapsulate_lsr_pkt(const neighbor *nbr, ospf_header *ospf_hdr);
+void encapsulate_lsr_pkt(const interface_data *iface, const neighbor *nbr, ospf_header *ospf_hdr);
 
 #endif            
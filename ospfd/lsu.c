@@ -1,14 +1,42 @@
 #include "lsu.h"
 #include "lsa.h"
+#include "ospfd.h"
 
 #include <string.h>
 
-void process_lsu_pkt(area *a, neighbor *nbr, ospf_header *ospf_hdr){
+static int append_lsa(int size, ospf_header *ospf_hdr, const ospf_lsa_header *lsa_hdr);
+static void init_lsu_pkt(ospf_header *ospf_hdr);
+
+/* Queue database copies, more recent than what the neighbor sent, in
+   as few LSUs as they fit; the one being built is in buf. */
+static void send_back_lsa(const interface_data *iface, neighbor *nbr, uint8_t *buf, const ospf_lsa_header *lsa_hdr){
+	ospf_header *ospf_hdr = (ospf_header *)(buf + sizeof(struct iphdr));
+	int size = ospf_packet_size(iface);
+	if(lsa_hdr == NULL || !append_lsa(size, ospf_hdr, lsa_hdr)){
+		if(ntohl(((ospf_lsu_pkt *)((uint8_t *)ospf_hdr + sizeof(ospf_header)))->num_of_lsa) > 0){
+			tx_enqueue(nbr, TX_PRIO_NORMAL, buf);
+		}
+		init_lsu_pkt(ospf_hdr);
+		if(lsa_hdr != NULL){
+			append_lsa(size, ospf_hdr, lsa_hdr);
+		}
+	}
+}
+
+void process_lsu_pkt(interface_data *iface, neighbor *nbr, ospf_header *ospf_hdr){
+	/* If the neighbor is in a lesser state than Exchange, the packet
+	   should be dropped without further processing. */
+	if(nbr == NULL || nbr->state < NEIGHBOR_STATE_EXCHANGE){
+		return ;
+	}
+	area *a = lookup_area_by_if(iface);
 	ospf_lsu_pkt *lsu = (ospf_lsu_pkt *)((uint8_t *)ospf_hdr + sizeof(ospf_header));
 	uint8_t *lsa_begin = (uint8_t *)ospf_hdr + sizeof(ospf_header) + sizeof(ospf_lsu_pkt);
 
-	// int num = ntohl(*((uint32_t *)((uint8_t *)ospf_hdr + sizeof(struct ospf_header))));
-	int num = lsu->num_of_lsa;
+	uint8_t back[BUFFER_SIZE];
+	init_lsu_pkt((ospf_header *)(back + sizeof(struct iphdr)));
+
+	int num = ntohl(lsu->num_of_lsa);
 	while(num--){
 		ospf_lsa_header *lsa_hdr = (ospf_lsa_header *)lsa_begin;
 
@@ -20,44 +48,293 @@ void process_lsu_pkt(area *a, neighbor *nbr, ospf_header *ospf_hdr){
 		}
 		lsa_hdr->ls_chksum = htons(sum);
 
-		for(int i = 0; i < nbr->num_lsa_hdr; i++){
-			if(lsa_hdr_eql(nbr->lsa_hdrs + i, lsa_hdr)){
-				// nbr->lsa_hdrs[i] = nbr->lsa_hdrs[--nbr->num_lsa_hdr];
-				nbr->num_lsa_hdr -= 1;
-				for(int j = i; j < nbr->num_lsa_hdr; j++){
-					nbr->lsa_hdrs[j] = nbr->lsa_hdrs[j+1];
-				}
-				break;
+		/* (5) A received instance more recent than the database copy
+		   (or with none there) is installed and flooded; (7) the same
+		   instance is a duplicate; (8) with a more recent database
+		   copy, that copy is sent back to the neighbor, neither
+		   acknowledged nor put on its retransmission list. */
+		const ospf_lsa_header *db = lookup_lsa(a, lsa_hdr);
+		int newer = (db == NULL) ? -1 : cmp_lsa_hdr(db, lsa_hdr);
+		if(newer > 0){
+			send_back_lsa(iface, nbr, back, db);
+			lsa_begin += ntohs(lsa_hdr->length);
+			continue;
+		}
+		int duplicate = (newer == 0);
+		if(lsa_list_del(&nbr->lsa_hdrs, lsa_hdr)){
+			nbr->lsr_answered = OSPFD_TRUE;
+		}
+		/* the same instance as the one on the retransmission list is
+		   taken as an implied acknowledgment (Section 13, step 7) */
+		int implied = OSPFD_FALSE;
+		ospf_lsa_header *sent = lsa_list_lookup(&nbr->rxmt, lsa_hdr);
+		if(sent != NULL && sent->ls_seqnum == lsa_hdr->ls_seqnum){
+			del_rxmt_lsa(nbr, lsa_hdr);
+			implied = OSPFD_TRUE;
+		}
+		/* 13.5. A new LSA is acknowledged with the delayed
+		   acknowledgments of the interface, a duplicate that was not
+		   an implied acknowledgment directly to the neighbor, and an
+		   implied acknowledgment not at all. */
+		if(!duplicate){
+			/* install it to the link state database of area a, and
+			   flood it out the other interfaces; one flooded back out
+			   the receiving interface needs no acknowledgment */
+			const ospf_lsa_header *installed = install_lsa(a, lsa_hdr);
+			if(installed == NULL || !flood_lsa(a, iface, nbr, installed)){
+				*lsa_list_add(&iface->delayed_acks, lsa_hdr) = *lsa_hdr;
 			}
 		}
-		/* add it to the ack list */
-		nbr->lsacks[nbr->num_lsack++] = *lsa_hdr;
-		/* install it to the link state database of area a */
-		install_lsa(a, lsa_hdr);
+		else if(!implied){
+			*lsa_list_add(&nbr->lsacks, lsa_hdr) = *lsa_hdr;
+		}
 		lsa_begin += ntohs(lsa_hdr->length);
 	}
+	send_back_lsa(iface, nbr, back, NULL);
 }
 
-void encapsulate_lsu_pkt(const area *a, const neighbor *nbr, ospf_header *ospf_hdr){
+/* Append lsa_hdr to the LSU being built, OSPFD_FALSE if the packet
+   would grow beyond size bytes (see ospf_packet_size()) */
+static int append_lsa(int size, ospf_header *ospf_hdr, const ospf_lsa_header *lsa_hdr){
 	ospf_lsu_pkt *lsu = (ospf_lsu_pkt *)((uint8_t *)ospf_hdr + sizeof(ospf_header));
-	uint8_t *lsa_begin = (uint8_t *)ospf_hdr + sizeof(ospf_header) + sizeof(ospf_lsu_pkt);
-	// uint8_t *p = (uint8_t *)ospf_hdr + sizeof(ospf_header) + 4;
-	
-	// *((uint32_t *)((uint8_t *)ospf_hdr + sizeof(struct ospf_header))) = ntohl(nbr->num_lsr);
-	lsu->num_of_lsa = ntohl(nbr->num_lsr);
-
-	for(int i = 0; i < nbr->num_lsr; i++){
-		for(int j = 0; j < a->num_lsa; j++){
-			if(nbr->lsrs[i].ls_type == htonl(a->lsas[j]->ls_type) &&
-				nbr->lsrs[i].link_state_id == a->lsas[j]->link_state_id &&
-				nbr->lsrs[i].adv_router == a->lsas[j]->adv_router){
-				size_t len = htons(a->lsas[j]->length);
-				memcpy(lsa_begin, a->lsas[j], len);
-				lsa_begin += len;
+	uint8_t *lsa_begin = (uint8_t *)ospf_hdr + ntohs(ospf_hdr->pktlen);
+	int len = ntohs(lsa_hdr->length);
+	if(ntohs(ospf_hdr->pktlen) + len > size){
+		return OSPFD_FALSE;
+	}
+	memcpy(lsa_begin, lsa_hdr, len);
+	lsu->num_of_lsa = htonl(ntohl(lsu->num_of_lsa) + 1);
+	ospf_hdr->pktlen = htons(ntohs(ospf_hdr->pktlen) + len);
+	return OSPFD_TRUE;
+}
+
+static void init_lsu_pkt(ospf_header *ospf_hdr){
+	ospf_lsu_pkt *lsu = (ospf_lsu_pkt *)((uint8_t *)ospf_hdr + sizeof(ospf_header));
+	lsu->num_of_lsa = htonl(0);
+	ospf_hdr->type = MSG_TYPE_LINK_STATE_UPDATE;
+	ospf_hdr->pktlen = htons(sizeof(ospf_header) + sizeof(ospf_lsu_pkt));
+}
+
+/* An LSA too long for any packet is dropped from the list it is on */
+static int lsa_fits(int size, const ospf_lsa_header *lsa_hdr){
+	return (int)(sizeof(ospf_header) + sizeof(ospf_lsu_pkt)) + ntohs(lsa_hdr->length) <= size;
+}
+
+/* The LSUs in flight to a neighbor are counted as the number of
+   packets the LSAs on its retransmission list fill. While there are
+   lsu_max_in_flight of them no more requested LSAs are sent; the
+   neighbor's acknowledgments open the window again, so a bulk database
+   load goes out at the pace the neighbor takes it in. */
+int lsu_window_open(const interface_data *iface, const neighbor *nbr){
+	if(lsu_max_in_flight <= 0){
+		return OSPFD_TRUE;
+	}
+	int payload = ospf_packet_size(iface) - sizeof(ospf_header) - sizeof(ospf_lsu_pkt);
+	return (nbr->rxmt_bytes + payload - 1) / payload < lsu_max_in_flight;
+}
+
+/* Answer the neighbor's Link State Requests with as many of the
+   requested LSAs as fit in one packet, returning how many were put in.
+   Each one sent moves from the request list to the Link state
+   retransmission list, and goes again only if it is not acknowledged
+   within the retransmission timeout of the neighbor once the packet
+   has left the transmit queue. Requests for LSAs no longer in the
+   database are dropped. */
+int encapsulate_lsu_pkt(const interface_data *iface, neighbor *nbr, ospf_header *ospf_hdr){
+	const area *a = lookup_area_by_if(iface);
+	int size = ospf_packet_size(iface);
+	init_lsu_pkt(ospf_hdr);
+	while(nbr->lsrs.num > 0){
+		ospf_lsa_header req = nbr->lsrs.lsas[nbr->lsrs.first];
+		const ospf_lsa_header *lsa_hdr = lookup_lsa(a, &req);
+		if(lsa_hdr != NULL && lsa_fits(size, lsa_hdr)){
+			if(!append_lsa(size, ospf_hdr, lsa_hdr)){
 				break;
 			}
+			queue_rxmt_lsa(nbr, lsa_hdr);
 		}
+		lsa_list_del(&nbr->lsrs, &req);
 	}
-	ospf_hdr->type = MSG_TYPE_LINK_STATE_UPDATE;
-	ospf_hdr->pktlen = htons(lsa_begin - (uint8_t *)ospf_hdr);
+	return ntohl(((ospf_lsu_pkt *)((uint8_t *)ospf_hdr + sizeof(ospf_header)))->num_of_lsa);
+}
+
+/* 13.6. Retransmitting LSAs */
+/* LSAs flooded out an adjacency are placed on the adjacency's Link
+   state retransmission list. In order to ensure that flooding is
+   reliable, these LSAs are retransmitted until they are acknowledged.
+   The length of time between retransmissions is a configurable per-
+   interface value, RxmtInterval. [...] When being retransmitted, LSAs
+   should be included in Link State Update packets that are sent
+   directly to the neighbor. */
+/* Instead of RxmtInterval, the time between retransmissions is the
+   retransmission timeout of the neighbor, see rtt_sample(). The LSAs
+   whose timers have fired are packed into one packet, as many as fit,
+   and wait for it to leave the transmit queue, skipped until then
+   (see queue_rxmt_lsa()); the current database copy is sent.
+   Returns how many were put in, 0 when none is due. */
+int encapsulate_rxmt_pkt(const interface_data *iface, neighbor *nbr, ospf_header *ospf_hdr){
+	const area *a = lookup_area_by_if(iface);
+	int size = ospf_packet_size(iface);
+	int64_t now = monotonic_ms();
+	/* the timeout before the one backed off below, so that each LSA
+	   goes at most once per call */
+	int rto = nbr->rto;
+	int retransmitted = OSPFD_FALSE;
+	init_lsu_pkt(ospf_hdr);
+	while(rxmt_due(nbr, rto) <= now){
+		int first = rxmt_first(nbr);
+		ospf_lsa_header entry = nbr->rxmt.lsas[first];
+		const ospf_lsa_header *lsa_hdr = lookup_lsa(a, &entry);
+		if(lsa_hdr == NULL || !lsa_fits(size, lsa_hdr)){
+			del_rxmt_lsa(nbr, &entry);
+			continue;
+		}
+		if(!append_lsa(size, ospf_hdr, lsa_hdr)){
+			break;
+		}
+		if(nbr->rxmt.sends[first] > 0){
+			retransmitted = OSPFD_TRUE;
+		}
+		queue_rxmt_lsa(nbr, lsa_hdr);
+	}
+	if(retransmitted){
+		rto_backoff(nbr, now);
+	}
+	return ntohl(((ospf_lsu_pkt *)((uint8_t *)ospf_hdr + sizeof(ospf_header)))->num_of_lsa);
+}
+
+/* An LSU built by encapsulate_lsu_pkt() or encapsulate_rxmt_pkt() has
+   left the neighbor's transmit queue at now: the retransmission timers
+   of its LSAs start now, see sent_rxmt_lsa(). */
+void lsu_sent(neighbor *nbr, const ospf_header *ospf_hdr, int64_t now){
+	if(ospf_hdr->type != MSG_TYPE_LINK_STATE_UPDATE){
+		return ;
+	}
+	const ospf_lsu_pkt *lsu = (const ospf_lsu_pkt *)((const uint8_t *)ospf_hdr + sizeof(ospf_header));
+	const uint8_t *lsa_begin = (const uint8_t *)lsu + sizeof(ospf_lsu_pkt);
+	for(int num = ntohl(lsu->num_of_lsa); num > 0; num--){
+		const ospf_lsa_header *lsa_hdr = (const ospf_lsa_header *)lsa_begin;
+		sent_rxmt_lsa(nbr, lsa_hdr, now);
+		lsa_begin += ntohs(lsa_hdr->length);
+	}
+}
+
+/* 13.3. Next step in the flooding procedure */
+/* Steps (1) to (5) for one eligible interface: the LSA goes on the
+   flooding queue of the interface, and on the pending list of each
+   adjacency that should get it; it is put on their retransmission
+   lists only when it is sent (see encapsulate_flood_pkt()). Returns
+   OSPFD_TRUE if it is to be flooded out the interface. */
+static int flood_out_interface(interface_data *iface, const interface_data *from_if, const neighbor *from,
+	const ospf_lsa_header *lsa_hdr, int64_t now){
+	int added = OSPFD_FALSE;
+	/* (3) If the new LSA was received on this interface, and it was
+	   received from either the Designated Router or the Backup
+	   Designated Router, chances are that all the neighbors have
+	   received the LSA already. It is not flooded, and so is not
+	   retransmitted either. */
+	int suppressed = iface == from_if && from != NULL &&
+		(from->neighbor_ip == iface->d_router || from->neighbor_ip == iface->bd_router);
+	for(neighbor *nbr = iface->neighbors; nbr != NULL; nbr = nbr->next){
+		/* (a) If the neighbor is in a lesser state than Exchange, it
+		   does not participate in flooding. */
+		if(nbr->state < NEIGHBOR_STATE_EXCHANGE){
+			continue;
+		}
+		/* (b) Else, if the adjacency is not yet full (neighbor state
+		   is Exchange or Loading), examine the Link state request
+		   list associated with this adjacency. If the new LSA is less
+		   recent than the one on the list, examine the next neighbor;
+		   if the two are the same instance, delete the LSA from the
+		   request list and examine the next neighbor; else the new
+		   LSA is more recent, delete it from the request list. */
+		if(nbr->state != NEIGHBOR_STATE_FULL){
+			ospf_lsa_header *req = lsa_list_lookup(&nbr->lsa_hdrs, lsa_hdr);
+			if(req != NULL){
+				int newer = cmp_lsa_hdr(req, lsa_hdr);
+				if(newer > 0){
+					continue;
+				}
+				lsa_list_del(&nbr->lsa_hdrs, lsa_hdr);
+				if(newer == 0){
+					continue;
+				}
+			}
+		}
+		/* (c) If the new LSA was received from this neighbor, examine
+		   the next neighbor. */
+		if(nbr == from){
+			continue;
+		}
+		/* (d) Add the new LSA to the Link state retransmission list
+		   for the adjacency, once it is sent. */
+		if(!suppressed){
+			lsa_list_add(&nbr->flood_pending, lsa_hdr);
+		}
+		added = OSPFD_TRUE;
+	}
+	/* (2) If in the previous step, the LSA was NOT added to any of the
+	   Link state retransmission lists, there is no need to flood the
+	   LSA out the interface. */
+	if(!added || suppressed){
+		return OSPFD_FALSE;
+	}
+	/* (5) the LSA is flooded out the interface when the pacing window
+	   opened by the first LSA on the queue closes */
+	if(iface->flood_queue.num == 0){
+		iface->flood_due = now + flood_delay;
+	}
+	lsa_list_add(&iface->flood_queue, lsa_hdr);
+	return OSPFD_TRUE;
+}
+
+/* Flood a newly installed LSA of area a, received from neighbor from
+   on interface from_if, out the eligible interfaces: those of the area,
+   or for an AS-external-LSA those of every area that is not a stub.
+   Returns OSPFD_TRUE if it is flooded back out the receiving interface. */
+int flood_lsa(area *a, const interface_data *from_if, const neighbor *from, const ospf_lsa_header *lsa_hdr){
+	int64_t now = monotonic_ms();
+	int back = OSPFD_FALSE;
+	for(int i = 0; i < num_area; i++){
+		area *scope = &areas[i];
+		if(lsa_hdr->ls_type == OSPF_AS_EXTERNAL_LSA ? !scope->external_routing_capability : scope != a){
+			continue;
+		}
+		for(int j = 0; j < scope->num_if; j++){
+			if(flood_out_interface(scope->ifs[j], from_if, from, lsa_hdr, now) && scope->ifs[j] == from_if){
+				back = OSPFD_TRUE;
+			}
+		}
+	}
+	return back;
+}
+
+/* Pack the LSAs on the flooding queue of iface, their current database
+   copies, into one packet, as many as fit. The packet is sent right
+   away, so each LSA put in goes on the retransmission lists of the
+   adjacencies it was pending for, timed from now. Returns how many
+   were put in; the queue is empty once it returns 0. */
+int encapsulate_flood_pkt(interface_data *iface, ospf_header *ospf_hdr){
+	const area *a = lookup_area_by_if(iface);
+	int size = ospf_packet_size(iface);
+	int64_t now = monotonic_ms();
+	init_lsu_pkt(ospf_hdr);
+	while(iface->flood_queue.num > 0){
+		ospf_lsa_header entry = iface->flood_queue.lsas[iface->flood_queue.first];
+		const ospf_lsa_header *lsa_hdr = lookup_lsa(a, &entry);
+		int flooded = OSPFD_FALSE;
+		if(lsa_hdr != NULL && lsa_fits(size, lsa_hdr)){
+			if(!append_lsa(size, ospf_hdr, lsa_hdr)){
+				break;
+			}
+			flooded = OSPFD_TRUE;
+		}
+		for(neighbor *nbr = iface->neighbors; nbr != NULL; nbr = nbr->next){
+			if(lsa_list_del(&nbr->flood_pending, &entry) && flooded){
+				add_rxmt_lsa(nbr, lsa_hdr, now);
+			}
+		}
+		lsa_list_del(&iface->flood_queue, &entry);
+	}
+	return ntohl(((ospf_lsu_pkt *)((uint8_t *)ospf_hdr + sizeof(ospf_header)))->num_of_lsa);
 }
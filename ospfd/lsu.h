@@ -133,7 +133,7 @@
    recent) LSA instance. */
 
 
-void process_lsu_pkt(area *a, neighbor *nbr, ospf_header *ospf_hdr);
+void process_lsu_pkt(interface_data *iface, neighbor *nbr, ospf_header *ospf_hdr);
 
 /* On broadcast networks, the Link State Update packets are
    multicast. The destination IP address specified for the
@@ -148,6 +148,11 @@ void process_lsu_pkt(area *a, neighbor *nbr, ospf_header *ospf_hdr);
    IP addresses for these packets are the neighbors’ IP
    addresses. */
 
-void encapsulate_lsu_pkt(const area *a, const neighbor *nbr, ospf_header *ospf_hdr);
+int encapsulate_lsu_pkt(const interface_data *iface, neighbor *nbr, ospf_header *ospf_hdr);
+int encapsulate_rxmt_pkt(const interface_data *iface, neighbor *nbr, ospf_header *ospf_hdr);
+void lsu_sent(neighbor *nbr, const ospf_header *ospf_hdr, int64_t now);
+int lsu_window_open(const interface_data *iface, const neighbor *nbr);
+int flood_lsa(area *a, const interface_data *from_if, const neighbor *from, const ospf_lsa_header *lsa_hdr);
+int encapsulate_flood_pkt(interface_data *iface, ospf_header *ospf_hdr);
 
 #endif
@@ -1,7 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/ip.h>
 
 #include "neighbor.h"
+#include "dd.h"
 #include "ospfd.h"
 
 const neighbor_sm_entry nsm[] = {
@@ -117,12 +121,122 @@ void print_neighbor_info(neighbor *nbr){
         printf("priority: %d\n", nbr->neighbor_priority);
         printf("ip: %s\n",  inet_ntoa((struct in_addr){nbr->neighbor_ip}));
         printf("master/slave: %d\n", nbr->master_slave_relationship);
-        printf("lsa number: %d\n", nbr->num_lsa_hdr);
+        printf("lsa number: %d\n", nbr->lsa_hdrs.num);
+        printf("tx queue: %d (max %d) sent: %u dropped: %u\n", nbr->txq.depth, nbr->txq.max_depth, nbr->txq.sent, nbr->txq.dropped);
         printf("--------------------------------\n");
 }
 
+/* The adjacencies waiting to be brought up, in the order they became
+   eligible, and when the last one was started. After an outage all the
+   neighbors become eligible at once; starting their Database Exchanges
+   together would overload the router and the links until they time out
+   and start over, so only adj_max_bringup of them are brought up at a
+   time, one every adj_start_gap milliseconds, first come first served. */
+static neighbor *adj_queue_head;
+static neighbor *adj_queue_tail;
+static int64_t adj_last_start;
+
+static void adj_queue_del(neighbor *nbr){
+	if(!nbr->adj_waiting){
+		return ;
+	}
+	neighbor **p = &adj_queue_head;
+	neighbor *prev = NULL;
+	while(*p != nbr){
+		prev = *p;
+		p = &(*p)->adj_next;
+	}
+	*p = nbr->adj_next;
+	if(adj_queue_tail == nbr){
+		adj_queue_tail = prev;
+	}
+	nbr->adj_next = NULL;
+	nbr->adj_waiting = OSPFD_FALSE;
+	nbr->adj_peer_started = OSPFD_FALSE;
+}
+
+/* the adjacencies in ExStart, Exchange or Loading */
+static int adj_bringup_count(){
+	int count = 0;
+	for(int i = 0; i < num_if; i++){
+		for(neighbor *nbr = ifs[i].neighbors; nbr; nbr = nbr->next){
+			if(nbr->state >= NEIGHBOR_STATE_EX_START && nbr->state <= NEIGHBOR_STATE_LOADING){
+				count++;
+			}
+		}
+	}
+	return count;
+}
+
+/* when the adjacency at the head of the queue may be started,
+   INT64_MAX if none waits or as many as allowed are being brought up */
+static int64_t adj_next_start(){
+	if(adj_queue_head == NULL || adj_bringup_count() >= adj_max_bringup){
+		return INT64_MAX;
+	}
+	return adj_last_start + adj_start_gap;
+}
+
+/* Whether the adjacency with the neighbor may go from 2-Way to
+   ExStart now; if not, it waits in the queue until adj_start_waiting()
+   starts it. An adjacency the neighbor has already started (see
+   process_dd_pkt()) is not held back: it takes a place in the
+   neighbor's own limit, and waiting for it here could leave two
+   routers each waiting for the other. */
+static int adj_admit(neighbor *nbr){
+	if(adj_max_bringup <= 0 || nbr->adj_peer_started){
+		adj_queue_del(nbr);
+		return OSPFD_TRUE;
+	}
+	if(!nbr->adj_waiting){
+		nbr->adj_waiting = OSPFD_TRUE;
+		if(adj_queue_tail != NULL){
+			adj_queue_tail->adj_next = nbr;
+		}
+		else{
+			adj_queue_head = nbr;
+		}
+		adj_queue_tail = nbr;
+	}
+	int64_t now = monotonic_ms();
+	if(adj_queue_head != nbr || adj_next_start() > now){
+		return OSPFD_FALSE;
+	}
+	adj_queue_del(nbr);
+	adj_last_start = now;
+	return OSPFD_TRUE;
+}
+
+/* start the waiting adjacencies whose turn has come, returning when the
+   next one may start, INT64_MAX if that is not known yet */
+int64_t adj_start_waiting(){
+	int64_t now = monotonic_ms();
+	while(adj_queue_head != NULL){
+		int64_t t = adj_next_start();
+		if(t > now){
+			return t;
+		}
+		neighbor *nbr = adj_queue_head;
+		for(int i = 0; i < num_if; i++){
+			for(neighbor *p = ifs[i].neighbors; p; p = p->next){
+				if(p == nbr){
+					add_neighbor_event(ifs + i, nbr, NEIGHBOR_EV_ADJ_OK);
+				}
+			}
+		}
+		if(adj_queue_head == nbr){
+			break;
+		}
+	}
+	return INT64_MAX;
+}
+
 void add_neighbor_event(interface_data *iface, neighbor *nbr, neighbor_event event){
 
+	if(event == NEIGHBOR_EV_ADJ_OK && nbr->state == NEIGHBOR_STATE_TWO_WAY && !adj_admit(nbr)){
+		return ;
+	}
+
 	printf("--------------------------------\n");
 
 	printf("Interface: %s\n", iface->if_name);
@@ -133,6 +247,14 @@ void add_neighbor_event(interface_data *iface, neighbor *nbr, neighbor_event eve
 	for (int i = 0; i < NEIGHBOR_SM_ENTRY_NUM; i++){
 		if((nbr->state == nsm[i].cur_state) && (event == nsm[i].recv_event)){
 			nbr->state = nsm[i].new_state;
+			/* the Database summary list is taken on entering Exchange,
+			   and is of no use in any other state */
+			if(nsm[i].cur_state == NEIGHBOR_STATE_EX_START && nbr->state == NEIGHBOR_STATE_EXCHANGE){
+				take_db_summary(iface, nbr);
+			}
+			else if(nbr->state != NEIGHBOR_STATE_EXCHANGE){
+				clear_db_summary(nbr);
+			}
 			if(nbr->state == NEIGHBOR_STATE_FULL){
 				if(iface->d_router == nbr->neighbor_ip){
 					iface->state = 1;
@@ -141,6 +263,10 @@ void add_neighbor_event(interface_data *iface, neighbor *nbr, neighbor_event eve
 			break;
 		}
 	}
+	/* an adjacency no longer to be formed leaves the queue */
+	if(nbr->state != NEIGHBOR_STATE_TWO_WAY || event == NEIGHBOR_EV_ADJ_NO){
+		adj_queue_del(nbr);
+	}
 
 	printf("New State: %s\n", neighbor_state_str[nbr->state]);
 
@@ -174,9 +300,29 @@ neighbor *neighbor_init(ospf_hello_pkt *hello, uint32_t router_id, in_addr_t src
 	nbr->options = hello->options;
 	nbr->d_router = hello->d_router;
 	nbr->bd_router = hello->bd_router;
-	nbr->num_lsa_hdr = 0;
-	nbr->num_lsr = 0;
-	nbr->num_lsack = 0;
+	memset(&nbr->lsa_hdrs, 0, sizeof(lsa_list));
+	nbr->lsr_answered = OSPFD_FALSE;
+	memset(&nbr->lsrs, 0, sizeof(lsa_list));
+	memset(&nbr->lsacks, 0, sizeof(lsa_list));
+	memset(&nbr->rxmt, 0, sizeof(lsa_list));
+	nbr->rxmt_bytes = 0;
+	memset(&nbr->flood_pending, 0, sizeof(lsa_list));
+	nbr->srtt = 0;
+	nbr->rttvar = 0;
+	nbr->rtt_valid = OSPFD_FALSE;
+	nbr->rto = OSPF_DEFAULT_RXMT_INTERVAL * 1000;
+	nbr->backoff_time = 0;
+	nbr->dd_time = 0;
+	nbr->dd_timed_seq = 0;
+	nbr->dd_timed = OSPFD_FALSE;
+	nbr->db_summary = NULL;
+	nbr->num_db_summary = 0;
+	nbr->db_cursor = 0;
+	nbr->dd_sent = 0;
+	memset(&nbr->txq, 0, sizeof(tx_queue));
+	nbr->adj_waiting = OSPFD_FALSE;
+	nbr->adj_peer_started = OSPFD_FALSE;
+	nbr->adj_next = NULL;
 	nbr->next = NULL;
 	nbr->more = 1;
 	printf("create a new neighbor\n");
@@ -185,7 +331,240 @@ neighbor *neighbor_init(ospf_hello_pkt *hello, uint32_t router_id, in_addr_t src
 }
 
 void clear_neighbor_lsas(neighbor *nbr){
-	nbr->num_lsa_hdr = 0;
-	nbr->num_lsr = 0;
-	nbr->num_lsack = 0;
+	lsa_list_clear(&nbr->lsa_hdrs);
+	lsa_list_clear(&nbr->lsrs);
+	lsa_list_clear(&nbr->lsacks);
+	lsa_list_clear(&nbr->rxmt);
+	nbr->rxmt_bytes = 0;
+	lsa_list_clear(&nbr->flood_pending);
+	tx_queue_clear(&nbr->txq);
+}
+
+void free_neighbor(neighbor *nbr){
+	lsa_list_free(&nbr->lsa_hdrs);
+	lsa_list_free(&nbr->lsrs);
+	lsa_list_free(&nbr->lsacks);
+	lsa_list_free(&nbr->rxmt);
+	lsa_list_free(&nbr->flood_pending);
+	clear_db_summary(nbr);
+	tx_queue_clear(&nbr->txq);
+	adj_queue_del(nbr);
+	nbr->rtt_valid = OSPFD_FALSE;
+	free(nbr);
+}
+
+void clear_db_summary(neighbor *nbr){
+	release_db_snapshot(nbr->db_summary);
+	nbr->db_summary = NULL;
+	nbr->num_db_summary = 0;
+	nbr->db_cursor = 0;
+	nbr->dd_sent = 0;
+}
+
+int64_t monotonic_ms(){
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (int64_t)t.tv_sec * 1000 + t.tv_nsec / 1000000;
+}
+
+/* 13.6. Retransmitting LSAs */
+/* Put an LSA that has been sent to the neighbor at sent (see
+   monotonic_ms()) on its Link state retransmission list, to be sent
+   again one retransmission timeout later unless it is acknowledged
+   before; sent is 0 for an LSA not sent yet, which is due at once.
+   The entry goes to the back of the list, so the LSAs are kept in the
+   order they are due and the ones to retransmit are always at the
+   front. sends[] counts the times the instance has been sent. */
+void add_rxmt_lsa(neighbor *nbr, const ospf_lsa_header *lsa_hdr, int64_t sent){
+	const ospf_lsa_header *old = lsa_list_lookup(&nbr->rxmt, lsa_hdr);
+	int sends = 0;
+	if(old != NULL && old->ls_seqnum == lsa_hdr->ls_seqnum){
+		sends = nbr->rxmt.sends[old - nbr->rxmt.lsas];
+	}
+	del_rxmt_lsa(nbr, lsa_hdr);
+	lsa_list_add(&nbr->rxmt, lsa_hdr);
+	nbr->rxmt.time[nbr->rxmt.len - 1] = sent;
+	nbr->rxmt.sends[nbr->rxmt.len - 1] = sends + (sent != 0);
+	nbr->rxmt_bytes += ntohs(lsa_hdr->length);
+}
+
+/* Put an LSA packed into an LSU waiting in the neighbor's transmit
+   queue at the back of the list, marked RXMT_QUEUED: it is not due
+   and not packed again until the packet leaves, when sent_rxmt_lsa()
+   counts the send and starts its timer. */
+void queue_rxmt_lsa(neighbor *nbr, const ospf_lsa_header *lsa_hdr){
+	const ospf_lsa_header *old = lsa_list_lookup(&nbr->rxmt, lsa_hdr);
+	int sends = 0;
+	if(old != NULL && old->ls_seqnum == lsa_hdr->ls_seqnum){
+		sends = nbr->rxmt.sends[old - nbr->rxmt.lsas];
+	}
+	del_rxmt_lsa(nbr, lsa_hdr);
+	lsa_list_add(&nbr->rxmt, lsa_hdr);
+	nbr->rxmt.time[nbr->rxmt.len - 1] = RXMT_QUEUED;
+	nbr->rxmt.sends[nbr->rxmt.len - 1] = sends;
+	nbr->rxmt_bytes += ntohs(lsa_hdr->length);
+}
+
+/* The LSU carrying the LSA has left the transmit queue at now. Unless
+   the LSA has been acknowledged or replaced meanwhile, its
+   retransmission timer starts from the time it was actually sent. */
+void sent_rxmt_lsa(neighbor *nbr, const ospf_lsa_header *lsa_hdr, int64_t now){
+	const ospf_lsa_header *entry = lsa_list_lookup(&nbr->rxmt, lsa_hdr);
+	if(entry != NULL && entry->ls_seqnum == lsa_hdr->ls_seqnum){
+		add_rxmt_lsa(nbr, lsa_hdr, now);
+	}
+}
+
+/* the LSA is acknowledged, or no longer to be retransmitted */
+void del_rxmt_lsa(neighbor *nbr, const ospf_lsa_header *lsa_hdr){
+	const ospf_lsa_header *entry = lsa_list_lookup(&nbr->rxmt, lsa_hdr);
+	if(entry != NULL){
+		nbr->rxmt_bytes -= ntohs(entry->length);
+		lsa_list_del(&nbr->rxmt, lsa_hdr);
+	}
+}
+
+/* The first entry of the retransmission list not waiting in the
+   transmit queue, the next one to fall due; -1 if there is none. */
+int rxmt_first(const neighbor *nbr){
+	const lsa_list *l = &nbr->rxmt;
+	for(int i = l->first; i < l->len; i++){
+		if(l->lsas[i].ls_type != 0 && l->time[i] != RXMT_QUEUED){
+			return i;
+		}
+	}
+	return -1;
+}
+
+/* when the first LSA of the retransmission list not waiting in the
+   transmit queue is due to be sent again with the timeout rto; one
+   not sent yet is due at once */
+int64_t rxmt_due(const neighbor *nbr, int rto){
+	int i = rxmt_first(nbr);
+	if(i < 0){
+		return INT64_MAX;
+	}
+	int64_t sent = nbr->rxmt.time[i];
+	return (sent == 0) ? 0 : sent + rto;
+}
+
+/* The LSA is acknowledged at now. The time since it was sent is a
+   round-trip sample unless it has been sent more than once, when the
+   acknowledgment may be for any of the copies (Karn's algorithm). */
+void ack_rxmt_lsa(neighbor *nbr, const ospf_lsa_header *lsa_hdr, int64_t now){
+	const ospf_lsa_header *entry = lsa_list_lookup(&nbr->rxmt, lsa_hdr);
+	if(entry == NULL){
+		return ;
+	}
+	int i = entry - nbr->rxmt.lsas;
+	if(nbr->rxmt.sends[i] == 1){
+		rtt_sample(nbr, now - nbr->rxmt.time[i]);
+	}
+	del_rxmt_lsa(nbr, lsa_hdr);
+}
+
+/* RFC 6298 2.2 and 2.3, with the clock granularity of 1 millisecond:
+   the first measurement R sets SRTT <- R, RTTVAR <- R/2; each later one
+   RTTVAR <- 3/4 RTTVAR + 1/4 |SRTT - R| and SRTT <- 7/8 SRTT + 1/8 R.
+   RTO <- SRTT + max(1, 4 RTTVAR), kept within rto_min and rto_max. */
+void rtt_sample(neighbor *nbr, int64_t rtt){
+	int r = (rtt < 0) ? 0 : (rtt > rto_max) ? rto_max : rtt;
+	if(!nbr->rtt_valid){
+		nbr->srtt = r;
+		nbr->rttvar = r / 2;
+		nbr->rtt_valid = OSPFD_TRUE;
+	}
+	else{
+		nbr->rttvar = (3 * nbr->rttvar + abs(nbr->srtt - r)) / 4;
+		nbr->srtt = (7 * nbr->srtt + r) / 8;
+	}
+	int rto = nbr->srtt + ((4 * nbr->rttvar > 1) ? 4 * nbr->rttvar : 1);
+	nbr->rto = (rto < rto_min) ? rto_min : (rto > rto_max) ? rto_max : rto;
+	nbr->backoff_time = 0;
+}
+
+/* RFC 6298 5.5: the timer has expired, back off the timeout, at most
+   once per timeout however many LSAs are retransmitted in it */
+void rto_backoff(neighbor *nbr, int64_t now){
+	if(now < nbr->backoff_time){
+		return ;
+	}
+	nbr->rto = (nbr->rto * 2 > rto_max) ? rto_max : nbr->rto * 2;
+	nbr->backoff_time = now + nbr->rto;
+}
+
+/* Queue a copy of the packet in buffer pkt (IP header first) to be
+   sent to the neighbor, FAILURE if the queue is full. */
+int tx_enqueue(neighbor *nbr, int prio, const uint8_t *pkt){
+	tx_queue *q = &nbr->txq;
+	if(q->depth >= tx_queue_max){
+		q->dropped++;
+		return FAILURE;
+	}
+	const ospf_header *ospf_hdr = (const ospf_header *)(pkt + sizeof(struct iphdr));
+	int len = sizeof(struct iphdr) + ntohs(ospf_hdr->pktlen);
+	tx_packet *p = malloc(sizeof(tx_packet) + len);
+	p->next = NULL;
+	p->len = len;
+	memcpy(p->data, pkt, len);
+	if(q->tail[prio] != NULL){
+		q->tail[prio]->next = p;
+	}
+	else{
+		q->head[prio] = p;
+	}
+	q->tail[prio] = p;
+	if(++q->depth > q->max_depth){
+		q->max_depth = q->depth;
+	}
+	return SUCCESS;
+}
+
+/* the time (see monotonic_ms()) the pacing lets the next packet go */
+int64_t tx_ready_time(const neighbor *nbr){
+	const tx_queue *q = &nbr->txq;
+	int64_t t = q->last_sent + tx_min_gap;
+	if(tx_max_burst > 0 && q->burst_sent >= tx_max_burst && q->burst_start + tx_burst_interval > t){
+		t = q->burst_start + tx_burst_interval;
+	}
+	return t;
+}
+
+/* Take the next packet to send at now, the caller frees it; NULL if
+   the queue is empty. The pacing is not checked, see tx_ready_time(). */
+tx_packet *tx_dequeue(neighbor *nbr, int64_t now){
+	tx_queue *q = &nbr->txq;
+	for(int i = 0; i < TX_NUM_PRIO; i++){
+		tx_packet *p = q->head[i];
+		if(p == NULL){
+			continue;
+		}
+		q->head[i] = p->next;
+		if(q->head[i] == NULL){
+			q->tail[i] = NULL;
+		}
+		q->depth--;
+		q->sent++;
+		q->last_sent = now;
+		if(now - q->burst_start >= tx_burst_interval){
+			q->burst_start = now;
+			q->burst_sent = 0;
+		}
+		q->burst_sent++;
+		return p;
+	}
+	return NULL;
+}
+
+/* drop the packets waiting, the counters are kept */
+void tx_queue_clear(tx_queue *q){
+	for(int i = 0; i < TX_NUM_PRIO; i++){
+		while(q->head[i] != NULL){
+			tx_packet *p = q->head[i];
+			q->head[i] = p->next;
+			free(p);
+		}
+		q->tail[i] = NULL;
+	}
+	q->depth = 0;
 }
@@ -2,8 +2,10 @@
 #define _NEIGHBOR_H
 
 #include "ospf_packets.h"
+#include "lsa_list.h"
 #include "interface.h"
 #include "area.h"
+#include "hash.h"
 #include "shared.h"
 
 #include <netinet/in.h>
@@ -79,6 +81,45 @@ typedef enum{
 }neighbor_state;
 
 
+/* transmit queue priorities, the retransmissions are sent first */
+#define TX_PRIO_RXMT 0
+#define TX_PRIO_NORMAL 1
+#define TX_NUM_PRIO 2
+
+/* the time of a retransmission list entry whose LSU is still in the
+   transmit queue, see queue_rxmt_lsa() */
+#define RXMT_QUEUED -1
+
+/* a packet in a transmit queue: the IP datagram as it was built */
+typedef struct tx_packet{
+	struct tx_packet *next;
+	int len;
+	uint8_t data[];
+}tx_packet;
+
+/* The Link State Update packets for a neighbor wait in its transmit
+   queue and are sent as the pacing allows, so that a burst of them
+   does not overrun the receive buffer of a slow neighbor: packets are
+   at least tx_min_gap milliseconds apart, and at most tx_max_burst go
+   out in tx_burst_interval milliseconds. Retransmissions have a queue
+   of their own that is served first. A packet that finds tx_queue_max
+   packets waiting is dropped; its LSAs are on the retransmission list
+   and go again later. */
+typedef struct tx_queue{
+	tx_packet *head[TX_NUM_PRIO];
+	tx_packet *tail[TX_NUM_PRIO];
+	/* packets waiting, and the most there have been */
+	int depth;
+	int max_depth;
+	/* packets sent and dropped since the neighbor was created */
+	unsigned int sent;
+	unsigned int dropped;
+	int64_t last_sent;
+	/* the start of the current burst interval and the packets sent in it */
+	int64_t burst_start;
+	int burst_sent;
+}tx_queue;
+
 typedef struct neighbor{
 	/* State - the functional level of the neighbor
 	   conversation. This is described in more detail
@@ -169,12 +210,48 @@ typedef struct neighbor{
         /* The list of LSAs that have been flooded but not acknowledged on
            this adjacency. These will be retransmitted at intervals until
            they are acknowledged, or until the adjacency is destroyed. */
+	lsa_list rxmt;
+	/* the total length of the LSAs on the list, see lsu_window_open() */
+	int rxmt_bytes;
+	/* LSAs waiting on the flooding queue of the interface to go out to
+	   the adjacency; each moves to the retransmission list when the
+	   packet flooding it is sent, see encapsulate_flood_pkt() */
+	lsa_list flood_pending;
+
+	/* The retransmission timeout in milliseconds, estimated from the
+	   round-trip times of the adjacency as TCP does (RFC 6298): srtt
+	   is the smoothed round-trip time and rttvar its variation, valid
+	   once rtt_valid is set by the first sample. It starts at
+	   RxmtInterval, and doubles each time LSAs have to be retransmitted,
+	   until a new sample comes (see rtt_sample()). */
+	int srtt;
+	int rttvar;
+	int rtt_valid;
+	int rto;
+	int64_t backoff_time;
+
+	/* when the master sent the Database Description packet of DD
+	   sequence number dd_timed_seq, OSPFD_FALSE in dd_timed if it has
+	   been sent again since and the response can not be timed */
+	int64_t dd_time;
+	uint32_t dd_timed_seq;
+	int dd_timed;
 
 	/* Database summary list */
 	/* The complete list of LSAs that make up the area link-state
            database, at the moment the neighbor goes into Database Exchange
            state. This list is sent to the neighbor in Database
            Description packets. */
+	/* The list is the area's snapshot taken when the neighbor enters
+	   Exchange, shared with the other neighbors (see db_snapshot), and
+	   is sent a packet at a time from db_cursor on. num_db_summary is
+	   its length, 0 when there is none. dd_sent is the number of
+	   headers in the packet not yet acknowledged; the cursor moves
+	   past them once it is. */
+	struct db_snapshot *db_summary;
+	int num_db_summary;
+	int db_cursor;
+	int dd_sent;
 
 	/* Link state request list */
 	/* The list of LSAs that need to be received from this neighbor in
@@ -183,16 +260,26 @@ typedef struct neighbor{
            received, and is then sent to the neighbor in Link State Request
            packets. The list is depleted as appropriate Link State Update
            packets are received. */
-	int num_lsa_hdr;
-	ospf_lsa_header lsa_hdrs[LIST_MAX];
+	lsa_list lsa_hdrs;
+	/* OSPFD_TRUE once an update has answered the last Link State
+	   Request, so the next one goes out without waiting RxmtInterval */
+	int lsr_answered;
 
-	/* The LSR packet received from the neighbor */
-	int num_lsr;
-	ospf_lsr_pkt lsrs[LIST_MAX];
+	/* The LSAs requested by the neighbor, only the LS type, Link State
+	   ID and Advertising Router are kept */
+	lsa_list lsrs;
 
 	/* The updated LSA header that need to ack */
-	int num_lsack;
-	ospf_lsa_header lsacks[LIST_MAX];
+	lsa_list lsacks;
+
+	tx_queue txq;
+
+	/* OSPFD_TRUE while the adjacency waits in 2-Way for its turn to be
+	   brought up (adj_next links the queue in order, see adj_admit()),
+	   adj_peer_started once the neighbor has started it anyway */
+	int adj_waiting;
+	int adj_peer_started;
+	struct neighbor *adj_next;
 
 	/* next neighbor */
 	struct neighbor *next;
@@ -298,4 +385,26 @@ neighbor *neighbor_init(ospf_hello_pkt *hello, uint32_t router_id, in_addr_t src
 
 void clear_neighbor_lsas(neighbor *nbr);
 
+void free_neighbor(neighbor *nbr);
+
+void clear_db_summary(neighbor *nbr);
+
+int64_t adj_start_waiting();
+
+int64_t monotonic_ms();
+void add_rxmt_lsa(neighbor *nbr, const ospf_lsa_header *lsa_hdr, int64_t sent);
+void queue_rxmt_lsa(neighbor *nbr, const ospf_lsa_header *lsa_hdr);
+void sent_rxmt_lsa(neighbor *nbr, const ospf_lsa_header *lsa_hdr, int64_t now);
+void del_rxmt_lsa(neighbor *nbr, const ospf_lsa_header *lsa_hdr);
+int rxmt_first(const neighbor *nbr);
+int64_t rxmt_due(const neighbor *nbr, int rto);
+void ack_rxmt_lsa(neighbor *nbr, const ospf_lsa_header *lsa_hdr, int64_t now);
+void rtt_sample(neighbor *nbr, int64_t rtt);
+void rto_backoff(neighbor *nbr, int64_t now);
+
+int tx_enqueue(neighbor *nbr, int prio, const uint8_t *pkt);
+int64_t tx_ready_time(const neighbor *nbr);
+tx_packet *tx_dequeue(neighbor *nbr, int64_t now);
+void tx_queue_clear(tx_queue *q);
+
 #endif
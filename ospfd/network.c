@@ -37,9 +37,11 @@ interface_data *recv_ospf(int sock, uint8_t buf[], int size, in_addr_t *src){
 	ospf_header *ospf_hdr;
 
 	int count = 0;
+	ssize_t len;
 
 	while(1){
-		if(recvfrom(sock, buf, size, 0, NULL, NULL) < sizeof(struct iphdr)){
+		len = recvfrom(sock, buf, size, 0, NULL, NULL);
+		if(len < (ssize_t)(sizeof(struct iphdr) + sizeof(ospf_header))){
 			continue;
 		}
 		ip_hdr = (struct iphdr *)buf;
@@ -48,6 +50,10 @@ interface_data *recv_ospf(int sock, uint8_t buf[], int size, in_addr_t *src){
 
 		if(ip_hdr->protocol == IPPROTO_OSPF){
 			ospf_hdr = (ospf_header *)(buf + sizeof(struct iphdr));
+			/* a packet cut short by the buffer is dropped */
+			if(sizeof(struct iphdr) + ntohs(ospf_hdr->pktlen) > (size_t)len){
+				continue;
+			}
 			memset(ospf_hdr->u.auth_data, 0, sizeof(ospf_hdr->u.auth_data));
 
 			if(cksum((uint16_t *)ospf_hdr, ntohs(ospf_hdr->pktlen))){
@@ -100,58 +106,95 @@ void send_ospf(const interface_data *iface, struct iphdr *ip_hdr, in_addr_t dst)
 	printf("send %s packet to %s\n", ospf_type_name[ospf_hdr->type], inet_ntoa((struct in_addr){dst}));
 }
 
-void *recv_and_process(){
-	uint8_t buf[BUFFER_SIZE];
-	interface_data *iface;
+static void process_ospf_pkt(interface_data *iface, uint8_t *buf, in_addr_t src){
 	ospf_header *ospf_hdr;
 	neighbor *nbr;
     area *a;
-	in_addr_t src;
-	while(1){
-		iface = recv_ospf(sock, buf, BUFFER_SIZE, &src);
-		if(iface == NULL){
-			continue ;
-		}
-		a = lookup_area_by_if(iface);
-		if(a == NULL){
-			// printf("Recv Error: Can not find the area.\n");
-			continue ;
-		}
 
-		ospf_hdr = (ospf_header *)(buf + sizeof(struct iphdr));
+	a = lookup_area_by_if(iface);
+	if(a == NULL){
+		// printf("Recv Error: Can not find the area.\n");
+		return ;
+	}
 
-		/* check if the packet is from myself */
-		if(ospf_hdr->router_id == my_router_id){
-			continue ;
+	ospf_hdr = (ospf_header *)(buf + sizeof(struct iphdr));
+
+	/* check if the packet is from myself */
+	if(ospf_hdr->router_id == my_router_id){
+		return ;
+	}
+
+	/* find the neighbor who send the packet */
+	for(nbr = iface->neighbors; nbr != NULL; nbr = nbr->next){
+		if(ospf_hdr->router_id == nbr->neighbor_id){
+			break;
 		}
+	}
 
-		/* find the neighbor who send the packet */
-		for(nbr = iface->neighbors; nbr != NULL; nbr = nbr->next){
-			if(ospf_hdr->router_id == nbr->neighbor_id){
-				break;
-			}
+	/* process packet */
+	switch(ospf_hdr->type){
+		case MSG_TYPE_HELLO:
+		    process_hello_pkt(iface, nbr, ospf_hdr, src);
+		    break;
+		case MSG_TYPE_DATABASE_DESCRIPTION:
+		    process_dd_pkt(iface, nbr, ospf_hdr);
+		    break;
+		case MSG_TYPE_LINK_STATE_REQUEST:
+		    process_lsr_pkt(iface, nbr, ospf_hdr);
+		    break;
+		case MSG_TYPE_LINK_STATE_UPDATE:
+		    process_lsu_pkt(iface, nbr, ospf_hdr);
+		    break;
+		case MSG_TYPE_LINK_STATE_ACK:
+		    process_lsack_pkt(nbr, ospf_hdr);
+		    break;
+		default:
+		    break;
+	}
+}
+
+/* Delayed acknowledgments and flooded LSAs are multicast to
+   AllSPFRouters if the router is the Designated Router or the Backup on
+   the interface, otherwise to AllDRouters (Sections 13.3 and 13.5). */
+static in_addr_t multicast_dst(const interface_data *iface){
+	if(iface->d_router == iface->ip || iface->bd_router == iface->ip){
+		return inet_addr(MCAST_ALL_SPF_ROUTERS);
+	}
+	return inet_addr(MCAST_ALL_DROUTERS);
+}
+
+/* flood the LSAs queued on iface once its pacing window has closed */
+static void send_flood_queue(interface_data *iface, uint8_t *buf){
+	if(iface->flood_queue.num == 0 || monotonic_ms() < iface->flood_due){
+		return ;
+	}
+	while(iface->flood_queue.num > 0){
+		if(encapsulate_flood_pkt(iface, (ospf_header *)(buf + sizeof(struct iphdr))) > 0){
+			send_ospf(iface, (struct iphdr *)buf, multicast_dst(iface));
 		}
+	}
+}
 
-		/* process packet */
-		switch(ospf_hdr->type){
-			case MSG_TYPE_HELLO:
-			    process_hello_pkt(iface, nbr, ospf_hdr, src);
-			    break;
-			case MSG_TYPE_DATABASE_DESCRIPTION:
-			    process_dd_pkt(iface, nbr, ospf_hdr);
-			    break;
-			case MSG_TYPE_LINK_STATE_REQUEST:
-			    process_lsr_pkt(iface, nbr, ospf_hdr);
-			    break;
-			case MSG_TYPE_LINK_STATE_UPDATE:
-			    process_lsu_pkt(a, nbr, ospf_hdr);
-			    break;
-			case MSG_TYPE_LINK_STATE_ACK:
-			    process_lsack_pkt(nbr, ospf_hdr);
-			    break;
-			default:
-			    break;
+void *recv_and_process(){
+	uint8_t buf[BUFFER_SIZE];
+	uint8_t out[BUFFER_SIZE];
+	interface_data *iface;
+	in_addr_t src;
+	while(1){
+		iface = recv_ospf(sock, buf, BUFFER_SIZE, &src);
+		if(iface == NULL){
+			continue ;
 		}
+		pthread_mutex_lock(&lsdb_lock);
+		process_ospf_pkt(iface, buf, src);
+		/* the packet may have completed an adjacency and made room for
+		   a waiting one */
+		adj_start_waiting();
+		/* the packet may have closed a pacing window */
+		for(int i = 0; i < num_if; i++){
+			send_flood_queue(ifs + i, out);
+		}
+		pthread_mutex_unlock(&lsdb_lock);
 	}
 }
 
@@ -163,9 +206,11 @@ void flood(){
 		if(my_router_lsa != NULL){
 			encapsulate_self_lsa(my_router_lsa, (ospf_header *)(buf + sizeof(struct iphdr)));
 			for(int j = 0; j < areas[i].num_if; j++){
-				for(neighbor *nbr = areas[i].ifs[i]->neighbors; nbr != NULL; nbr = nbr->next){
+				const interface_data *iface = areas[i].ifs[j];
+				for(neighbor *nbr = iface->neighbors; nbr != NULL; nbr = nbr->next){
 					if(nbr->state == NEIGHBOR_STATE_FULL){
-						send_ospf(areas[i].ifs[i], (struct iphdr *)buf, nbr->neighbor_ip);
+						send_ospf(iface, (struct iphdr *)buf, nbr->neighbor_ip);
+						add_rxmt_lsa(nbr, my_router_lsa, monotonic_ms());
 					}
 				}
 			}
@@ -175,9 +220,66 @@ void flood(){
 	// printf("try flood\n");
 }
 
+/* Send what the pacing of the neighbor's transmit queue lets go now,
+   returning the time the next packet may go, INT64_MAX if none waits */
+static int64_t drain_tx_queue(const interface_data *iface, neighbor *nbr){
+	int64_t now = monotonic_ms();
+	while(nbr->txq.depth > 0 && tx_ready_time(nbr) <= now){
+		tx_packet *p = tx_dequeue(nbr, now);
+		send_ospf(iface, (struct iphdr *)p->data, nbr->neighbor_ip);
+		lsu_sent(nbr, (const ospf_header *)(p->data + sizeof(struct iphdr)), now);
+		free(p);
+	}
+	return (nbr->txq.depth > 0) ? tx_ready_time(nbr) : INT64_MAX;
+}
+
+/* until deadline, retransmit the LSAs whose timers fire and send the
+   packets in the neighbors' transmit queues as their pacing allows,
+   sleeping in between; the timers run on the retransmission timeouts
+   of the neighbors, finer than the one second tick */
+static void pace_tx_queues(int64_t deadline){
+	uint8_t buf[BUFFER_SIZE];
+	while(1){
+		pthread_mutex_lock(&lsdb_lock);
+		int64_t wake = adj_start_waiting();
+		if(wake > deadline){
+			wake = deadline;
+		}
+		for(int i = 0; i < num_if; i++){
+			for(neighbor *nbr = ifs[i].neighbors; nbr; nbr = nbr->next){
+				if(nbr->state >= NEIGHBOR_STATE_EXCHANGE){
+					while(nbr->txq.depth < tx_queue_max &&
+						encapsulate_rxmt_pkt(ifs + i, nbr, (ospf_header *)(buf + sizeof(struct iphdr))) > 0){
+						tx_enqueue(nbr, TX_PRIO_RXMT, buf);
+					}
+				}
+				int64_t t = drain_tx_queue(ifs + i, nbr);
+				if(t < wake){
+					wake = t;
+				}
+				/* a full queue wakes up when it may send */
+				if(nbr->state >= NEIGHBOR_STATE_EXCHANGE && nbr->txq.depth < tx_queue_max &&
+					rxmt_due(nbr, nbr->rto) < wake){
+					wake = rxmt_due(nbr, nbr->rto);
+				}
+			}
+		}
+		pthread_mutex_unlock(&lsdb_lock);
+		int64_t now = monotonic_ms();
+		if(now >= deadline){
+			return ;
+		}
+		if(wake > now){
+			usleep((wake - now) * 1000);
+		}
+	}
+}
+
 void *encapsulate_and_send(){
 	uint8_t buf[BUFFER_SIZE];
 	while(1){
+		int64_t deadline = monotonic_ms() + 1000;
+		pthread_mutex_lock(&lsdb_lock);
 		flood();
 		for(int i = 0; i < num_if; i++){
 			area *a = lookup_area_by_if(ifs + i);
@@ -195,15 +297,18 @@ void *encapsulate_and_send(){
 			/* update timers */
 			ifs[i].hello_timer += 1;
 			ifs[i].rxmt_timer += 1;
+			ifs[i].ack_timer += 1;
 
 			/* remove out-of-date neighbors */
 			neighbor **p = &ifs[i].neighbors;
 			for(neighbor *q = *p; q; q = *p){
 				q->inactivity_timer += 1;
 				if(q->inactivity_timer >= ifs[i].router_dead_interval){
+					/* switch to the loop-free alternates right away */
+					route_neighbor_down(q->neighbor_ip);
 					ifs[i].num_neighbor -= 1;
 					*p = q->next;
-					free(q);
+					free_neighbor(q);
 				}
 				else{
 					p = &q->next;
@@ -233,7 +338,10 @@ void *encapsulate_and_send(){
 					if(nbr->state == NEIGHBOR_STATE_EX_START || nbr->state == NEIGHBOR_STATE_EXCHANGE){
 						encapsulate_dd_pkt(ifs + i, nbr, (ospf_header *)(buf + sizeof(struct iphdr)));
 						send_ospf(ifs + i, (struct iphdr *)buf, nbr->neighbor_ip);
-						if(nbr->master_slave_relationship == DD_SLAVE && nbr->more == 0){
+						/* the slave is done once it has sent a packet with the M
+						   bit off in response to one from the master */
+						if(nbr->master_slave_relationship == DD_SLAVE && nbr->more == 0 &&
+							nbr->db_cursor + nbr->dd_sent >= nbr->num_db_summary){
 							add_neighbor_event(ifs + i, nbr, NEIGHBOR_EV_EXCHANGE_DONE);
 						}
 					}
@@ -241,25 +349,31 @@ void *encapsulate_and_send(){
 						send_ospf(ifs + i, (struct iphdr *)nbr->pre_dd_pkt, nbr->neighbor_ip);
 					}
 					// printf("try dd 2\n");
-					/* send lsr packet */
-					if(nbr->state == NEIGHBOR_STATE_EXCHANGE || nbr->state == NEIGHBOR_STATE_LOADING){
-						if(nbr->num_lsa_hdr > 0){
-							encapsulate_lsr_pkt(nbr, (ospf_header *)(buf + sizeof(struct iphdr)));
-							send_ospf(ifs + i, (struct iphdr *)buf, nbr->neighbor_ip);
-						}				
-					}
-					// printf("try lsr\n");
-					/* send lsu packet for request */
-					if(nbr->num_lsr > 0 && nbr->state >= NEIGHBOR_STATE_EXCHANGE){
-						encapsulate_lsu_pkt(a, nbr, (ospf_header *)(buf + sizeof(struct iphdr)));
+				}
+				/* send lsr packet: the requests that do not fit in one
+				   packet go in the next, once this one is answered */
+				if(nbr->state == NEIGHBOR_STATE_EXCHANGE || nbr->state == NEIGHBOR_STATE_LOADING){
+					if(nbr->lsa_hdrs.num > 0 && (nbr->lsr_answered || ifs[i].rxmt_timer >= ifs[i].rxmt_interval)){
+						encapsulate_lsr_pkt(ifs + i, nbr, (ospf_header *)(buf + sizeof(struct iphdr)));
 						send_ospf(ifs + i, (struct iphdr *)buf, nbr->neighbor_ip);
+						nbr->lsr_answered = OSPFD_FALSE;
+					}
+				}
+				// printf("try lsr\n");
+				/* answer the requests of the neighbor as far as the LSUs
+				   in flight and the transmit queue allow; the
+				   retransmissions are left to pace_tx_queues() */
+				if(nbr->state >= NEIGHBOR_STATE_EXCHANGE){
+					while(nbr->lsrs.num > 0 && lsu_window_open(ifs + i, nbr) && nbr->txq.depth < tx_queue_max){
+						if(encapsulate_lsu_pkt(ifs + i, nbr, (ospf_header *)(buf + sizeof(struct iphdr))) > 0){
+							tx_enqueue(nbr, TX_PRIO_NORMAL, buf);
+						}
 					}
-					// printf("try lsu\n");
-					
 				}
-				/* send ls ack packet */
-				if(nbr->num_lsack > 0){
-					encapsulate_lsack_pkt(nbr, (ospf_header *)(buf + sizeof(struct iphdr)));
+				// printf("try lsu\n");
+				/* send the direct acknowledgments */
+				while(nbr->lsacks.num > 0){
+					encapsulate_lsack_pkt(ifs + i, &nbr->lsacks, (ospf_header *)(buf + sizeof(struct iphdr)));
 					send_ospf(ifs + i, (struct iphdr *)buf, nbr->neighbor_ip);
 				}
 				// printf("try lsack\n");
@@ -267,8 +381,19 @@ void *encapsulate_and_send(){
 			if(ifs[i].rxmt_timer >= ifs[i].rxmt_interval){
 				ifs[i].rxmt_timer = 0;
 			}
+			/* flood the LSAs whose pacing window has closed, then send
+			   the delayed acknowledgments of all the neighbors */
+			send_flood_queue(ifs + i, buf);
+			if(ifs[i].delayed_acks.num > 0 && ifs[i].ack_timer >= ifs[i].ack_delay){
+				while(ifs[i].delayed_acks.num > 0){
+					encapsulate_lsack_pkt(ifs + i, &ifs[i].delayed_acks, (ospf_header *)(buf + sizeof(struct iphdr)));
+					send_ospf(ifs + i, (struct iphdr *)buf, multicast_dst(ifs + i));
+				}
+				ifs[i].ack_timer = 0;
+			}
 		}
-		sleep(1); 
+		pthread_mutex_unlock(&lsdb_lock);
+		pace_tx_queues(deadline);
 	}
 	return NULL;
 }
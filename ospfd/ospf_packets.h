@@ -512,7 +512,7 @@ typedef struct network_lsa{
        Designated Router are listed. The Designated Router includes
        itself in this list. The number of routers included can be
        deduced from the LSA header’s length field. */
-	in_addr_t *attached_rtrs;
+	in_addr_t attached_rtrs[];
 }network_lsa;
 
 
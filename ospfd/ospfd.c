@@ -1,9 +1,11 @@
 #include "ospfd.h"
 #include "network.h"
 #include "lsa.h"
+#include "spf.h"
 #include <stdio.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <time.h>
 
 #define NIPQUAD_FMT "%u.%u.%u.%u"
 #define NIPQUAD(addr) \
@@ -29,22 +31,113 @@ in_addr_t my_router_id;
 
 ospf_lsa_header *my_router_lsa;
 
-int num_route;
-route routing_table[NUM_ROUTE];
+route_table routing_table;
 
-int old_num_route;
-route old_routing_table[NUM_ROUTE];
+/* the routing table before the last calculation */
+route_table old_routing_table;
 
 int RFC1583Compatibility;
 
+/* the AS-external-LSAs shared by all non-stub areas */
+external_lsdb as_external;
+
+/* candidate list used by the Dijkstra calculation, see pqueue.h */
+int spf_queue_type;
+
+/* repair the previous shortest-path tree after small changes */
+int spf_incremental;
+
+/* SPF throttling timers in milliseconds, see spf_wait() */
+int spf_initial_delay;
+int spf_hold_time;
+int spf_max_wait;
+
+/* Held by whichever thread is reading or changing the link state
+   databases and the routing table. spf_cond is signalled when a
+   database changes. */
+pthread_mutex_t lsdb_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t spf_cond;
+
+/* Held while the routes on the host are changed, so that they match
+   the routing table whenever it is released. Taken after lsdb_lock
+   when both are held. */
+pthread_mutex_t fib_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* worker threads for the routing table calculation, see pool.h */
+int spf_threads;
+thread_pool spf_pool;
+
+/* areas with at least this many routers and transit networks are
+   calculated by parallel delta-stepping, 0 never */
+int spf_parallel_threshold;
+
+/* precompute loop-free alternates (RFC 5286) as backup next hops */
+int spf_lfa;
+
+/* reuse the tree of a topology seen shortly before, see spf_memo */
+int spf_memo_enabled;
+
+/* cap on the LSUs answering requests outstanding per neighbor, 0 none */
+int lsu_max_in_flight;
+
+/* pacing window of the flooding procedure in milliseconds, see
+   flood_lsa() */
+int flood_delay;
+
+/* pacing of the neighbors' transmit queues, see tx_queue; a
+   tx_max_burst of 0 leaves only the minimum gap */
+int tx_min_gap;
+int tx_max_burst;
+int tx_burst_interval;
+int tx_queue_max;
+
+/* bounds of the neighbors' retransmission timeouts in milliseconds */
+int rto_min;
+int rto_max;
+
+/* adjacencies being brought up at once (0 for no limit) and the
+   milliseconds between starting two of them */
+int adj_max_bringup;
+int adj_start_gap;
+
 void global_value_init(){
 	num_area = 0;
 	num_if = 0;
 	my_router_id = 0;
 	my_router_lsa = NULL;
-	num_route = 0;
-	old_num_route = 0;
+	routing_table.num = 0;
+	old_routing_table.num = 0;
 	RFC1583Compatibility = ENABLED;
+	spf_queue_type = SPF_QUEUE_HEAP;
+	spf_incremental = ENABLED;
+	spf_initial_delay = SPF_DEFAULT_INITIAL_DELAY;
+	spf_hold_time = SPF_DEFAULT_HOLD_TIME;
+	spf_max_wait = SPF_DEFAULT_MAX_WAIT;
+	spf_parallel_threshold = SPF_DEFAULT_PARALLEL_THRESHOLD;
+	spf_lfa = ENABLED;
+	spf_memo_enabled = ENABLED;
+	lsu_max_in_flight = LSU_DEFAULT_MAX_IN_FLIGHT;
+	flood_delay = FLOOD_DEFAULT_DELAY;
+	tx_min_gap = TX_DEFAULT_MIN_GAP;
+	tx_max_burst = TX_DEFAULT_MAX_BURST;
+	tx_burst_interval = TX_DEFAULT_BURST_INTERVAL;
+	tx_queue_max = TX_DEFAULT_QUEUE_MAX;
+	rto_min = RTO_DEFAULT_MIN;
+	rto_max = RTO_DEFAULT_MAX;
+	adj_max_bringup = ADJ_DEFAULT_MAX_BRINGUP;
+	adj_start_gap = ADJ_DEFAULT_START_GAP;
+
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&spf_cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	/* the main thread takes part in the calculation as well */
+	spf_threads = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+	if(spf_threads < 0){
+		spf_threads = 0;
+	}
 }
 
 void set_my_router_id(){
@@ -98,18 +191,25 @@ int main(void){
 
     print_global_info();
 
+	thread_pool_init(&spf_pool, spf_threads);
+
     pthread_create(&t_recv, NULL, recv_and_process, NULL);
 	pthread_create(&t_send, NULL, encapsulate_and_send, NULL);
-    /* main loop */
+    /* main loop: the router-LSAs are originated by flood(), the
+       routing table is calculated whenever a database has changed */
+	pthread_mutex_lock(&lsdb_lock);
     while(1){
-    	/* step 1: originate self LSA */
-    	for(int i = 0; i < num_area; i++){
-			my_router_lsa = originate_router_lsa(&areas[i]);
-		}
+		spf_wait();
 		invalidated_old_routing_table();
 		update_routing_table();
-		sleep(5);
+		/* the host is updated from a copy with lsdb_lock released */
+		pthread_mutex_lock(&fib_lock);
+		pthread_mutex_unlock(&lsdb_lock);
+		apply_routing_table();
+		pthread_mutex_unlock(&fib_lock);
+		pthread_mutex_lock(&lsdb_lock);
     }
+	pthread_mutex_unlock(&lsdb_lock);
     pthread_join(t_recv, NULL);
 	pthread_join(t_send, NULL);
 
@@ -2,9 +2,11 @@
 #define _OSPFD_H
 
 #include <unistd.h>
+#include <pthread.h>
 
 #include "route.h"
 #include "area.h"
+#include "pool.h"
 #include "shared.h"
 
 extern const char *ospf_type_name[];
@@ -20,10 +22,35 @@ extern int num_if;
 extern interface_data ifs[];
 extern in_addr_t my_router_id;
 extern ospf_lsa_header *my_router_lsa;
-extern int num_route;
-extern route routing_table[];
-extern int old_num_route;
-extern route old_routing_table[];
+extern route_table routing_table;
+extern route_table old_routing_table;
 extern int RFC1583Compatibility;
+extern external_lsdb as_external;
+extern int spf_queue_type;
+extern int spf_incremental;
+extern int spf_initial_delay;
+extern int spf_hold_time;
+extern int spf_max_wait;
+extern pthread_mutex_t lsdb_lock;
+extern pthread_cond_t spf_cond;
+extern pthread_mutex_t fib_lock;
+extern int spf_threads;
+extern thread_pool spf_pool;
+extern int spf_parallel_threshold;
+extern int spf_lfa;
+extern int spf_memo_enabled;
+extern int lsu_max_in_flight;
+extern int flood_delay;
+extern int tx_min_gap;
+extern int tx_max_burst;
+extern int tx_burst_interval;
+extern int tx_queue_max;
+extern int rto_min;
+extern int rto_max;
+extern int adj_max_bringup;
+extern int adj_start_gap;
+
+/* sets the globals above to their defaults */
+void global_value_init();
 
 #endif
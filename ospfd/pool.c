@@ -0,0 +1,96 @@
+#include "pool.h"
+
+#include <stdlib.h>
+
+/* set while the thread runs a job of a batch */
+static __thread int in_job;
+
+/* take jobs off the current batch until there are none left; called
+   and returns with p->lock held */
+static void run_jobs(thread_pool *p){
+	void (*job)(void *arg, int i) = p->job;
+	void *arg = p->arg;
+	while(p->next_job < p->num_job){
+		int i = p->next_job++;
+		pthread_mutex_unlock(&p->lock);
+		in_job = 1;
+		job(arg, i);
+		in_job = 0;
+		pthread_mutex_lock(&p->lock);
+		if(++p->num_done == p->num_job){
+			pthread_cond_broadcast(&p->finish);
+		}
+	}
+}
+
+static void *worker(void *arg){
+	thread_pool *p = arg;
+	unsigned int batch = 0;
+	pthread_mutex_lock(&p->lock);
+	while(1){
+		while(p->batch == batch){
+			pthread_cond_wait(&p->start, &p->lock);
+		}
+		batch = p->batch;
+		run_jobs(p);
+	}
+	return NULL;
+}
+
+void thread_pool_init(thread_pool *p, int num_thread){
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->start, NULL);
+	pthread_cond_init(&p->finish, NULL);
+	p->busy = 0;
+	p->batch = 0;
+	p->num_job = 0;
+	p->next_job = 0;
+	p->num_done = 0;
+	p->threads = malloc(num_thread * sizeof(pthread_t));
+	p->num_thread = 0;
+	for(int i = 0; i < num_thread; i++){
+		if(pthread_create(&p->threads[p->num_thread], NULL, worker, p) == 0){
+			p->num_thread++;
+		}
+	}
+}
+
+void thread_pool_run(thread_pool *p, int num_job, void (*job)(void *arg, int i), void *arg){
+	if(p->num_thread > 0 && num_job > 1 && !in_job){
+		pthread_mutex_lock(&p->lock);
+		if(!p->busy){
+			p->busy = 1;
+			p->job = job;
+			p->arg = arg;
+			p->num_job = num_job;
+			p->next_job = 0;
+			p->num_done = 0;
+			p->batch++;
+			pthread_cond_broadcast(&p->start);
+			run_jobs(p);
+			while(p->num_done < p->num_job){
+				pthread_cond_wait(&p->finish, &p->lock);
+			}
+			p->busy = 0;
+			pthread_mutex_unlock(&p->lock);
+			return ;
+		}
+		pthread_mutex_unlock(&p->lock);
+	}
+	for(int i = 0; i < num_job; i++){
+		job(arg, i);
+	}
+}
+
+/* whether a batch started now by the calling thread would be shared
+   with the workers: there are some, no batch is running and the caller
+   is not itself running a job */
+int thread_pool_idle(thread_pool *p){
+	if(p->num_thread == 0 || in_job){
+		return 0;
+	}
+	pthread_mutex_lock(&p->lock);
+	int idle = !p->busy;
+	pthread_mutex_unlock(&p->lock);
+	return idle;
+}
@@ -0,0 +1,33 @@
+#ifndef _POOL_H
+#define _POOL_H
+
+#include <pthread.h>
+
+/* A fixed set of worker threads that run batches of independent jobs,
+   used to spread the routing table calculation over several cores.
+   thread_pool_run() hands out the jobs 0 .. num_job - 1 of a batch to
+   the workers and to the calling thread, and returns once all of them
+   have finished. A batch started from inside a job of another batch,
+   while another batch is running, or on a pool without workers, is
+   simply run by the calling thread; thread_pool_idle() tells whether
+   a batch would get the workers. */
+typedef struct thread_pool{
+	int num_thread;
+	pthread_t *threads;
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t finish;
+	int busy;
+	unsigned int batch;
+	void (*job)(void *arg, int i);
+	void *arg;
+	int num_job;
+	int next_job;
+	int num_done;
+}thread_pool;
+
+void thread_pool_init(thread_pool *p, int num_thread);
+void thread_pool_run(thread_pool *p, int num_job, void (*job)(void *arg, int i), void *arg);
+int thread_pool_idle(thread_pool *p);
+
+#endif
@@ -0,0 +1,165 @@
+#include "pqueue.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static void spf_queue_reserve(spf_queue *q, int num_vertex){
+	if(num_vertex <= q->cap){
+		return ;
+	}
+	q->cap = num_vertex;
+	q->key = realloc(q->key, num_vertex * sizeof(uint32_t));
+	q->pos = realloc(q->pos, num_vertex * sizeof(int));
+	q->heap = realloc(q->heap, num_vertex * sizeof(int));
+	q->next = realloc(q->next, num_vertex * sizeof(int));
+	q->prev = realloc(q->prev, num_vertex * sizeof(int));
+}
+
+/* ties are broken on the vertex index so the order is deterministic */
+static int heap_less(const spf_queue *q, int u, int v){
+	return q->key[u] < q->key[v] || (q->key[u] == q->key[v] && u < v);
+}
+
+static void heap_swap(spf_queue *q, int i, int j){
+	int t = q->heap[i];
+	q->heap[i] = q->heap[j];
+	q->heap[j] = t;
+	q->pos[q->heap[i]] = i;
+	q->pos[q->heap[j]] = j;
+}
+
+static void heap_up(spf_queue *q, int i){
+	while(i > 0 && heap_less(q, q->heap[i], q->heap[(i - 1) / 2])){
+		heap_swap(q, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void heap_down(spf_queue *q, int i){
+	while(1){
+		int l = 2 * i + 1, r = l + 1, m = i;
+		if(l < q->size && heap_less(q, q->heap[l], q->heap[m])){
+			m = l;
+		}
+		if(r < q->size && heap_less(q, q->heap[r], q->heap[m])){
+			m = r;
+		}
+		if(m == i){
+			return ;
+		}
+		heap_swap(q, i, m);
+		i = m;
+	}
+}
+
+static void heap_reset(spf_queue *q, int num_vertex, uint32_t max_metric){
+	spf_queue_reserve(q, num_vertex);
+	memset(q->pos, 0xff, num_vertex * sizeof(int));
+	q->size = 0;
+}
+
+static void heap_update(spf_queue *q, int v, uint32_t key){
+	if(q->pos[v] == -1){
+		q->key[v] = key;
+		q->heap[q->size] = v;
+		q->pos[v] = q->size++;
+		heap_up(q, q->pos[v]);
+	}
+	else if(key < q->key[v]){
+		q->key[v] = key;
+		heap_up(q, q->pos[v]);
+	}
+}
+
+static int heap_pop(spf_queue *q){
+	if(q->size == 0){
+		return -1;
+	}
+	int v = q->heap[0];
+	heap_swap(q, 0, --q->size);
+	q->pos[v] = -1;
+	heap_down(q, 0);
+	return v;
+}
+
+static void bucket_unlink(spf_queue *q, int v){
+	int b = q->key[v] % q->num_bucket;
+	if(q->prev[v] != -1){
+		q->next[q->prev[v]] = q->next[v];
+	}
+	else{
+		q->bucket[b] = q->next[v];
+	}
+	if(q->next[v] != -1){
+		q->prev[q->next[v]] = q->prev[v];
+	}
+}
+
+static void bucket_reset(spf_queue *q, int num_vertex, uint32_t max_metric){
+	spf_queue_reserve(q, num_vertex);
+	memset(q->pos, 0xff, num_vertex * sizeof(int));
+	/* keys of queued vertices always lie in [cursor, cursor + max_metric] */
+	q->num_bucket = max_metric + 1;
+	if(q->num_bucket > q->bucket_cap){
+		q->bucket_cap = q->num_bucket;
+		q->bucket = realloc(q->bucket, q->bucket_cap * sizeof(int));
+	}
+	memset(q->bucket, 0xff, q->num_bucket * sizeof(int));
+	q->size = 0;
+	q->cursor = 0;
+}
+
+static void bucket_update(spf_queue *q, int v, uint32_t key){
+	if(q->pos[v] != -1){
+		if(key >= q->key[v]){
+			return ;
+		}
+		bucket_unlink(q, v);
+		q->size--;
+	}
+	if(q->size == 0 || key < q->cursor){
+		q->cursor = key;
+	}
+	int b = key % q->num_bucket;
+	q->key[v] = key;
+	q->pos[v] = 1;
+	q->prev[v] = -1;
+	q->next[v] = q->bucket[b];
+	if(q->bucket[b] != -1){
+		q->prev[q->bucket[b]] = v;
+	}
+	q->bucket[b] = v;
+	q->size++;
+}
+
+static int bucket_pop(spf_queue *q){
+	if(q->size == 0){
+		return -1;
+	}
+	while(q->bucket[q->cursor % q->num_bucket] == -1){
+		q->cursor++;
+	}
+	int v = q->bucket[q->cursor % q->num_bucket];
+	bucket_unlink(q, v);
+	q->pos[v] = -1;
+	q->size--;
+	return v;
+}
+
+const spf_queue_ops spf_heap_ops = {"binary heap", heap_reset, heap_update, heap_pop};
+const spf_queue_ops spf_bucket_ops = {"bucket queue", bucket_reset, bucket_update, bucket_pop};
+
+void spf_queue_init(spf_queue *q, int type){
+	memset(q, 0, sizeof(spf_queue));
+	q->ops = (type == SPF_QUEUE_BUCKET) ? &spf_bucket_ops : &spf_heap_ops;
+}
+
+void spf_queue_free(spf_queue *q){
+	free(q->key);
+	free(q->pos);
+	free(q->heap);
+	free(q->bucket);
+	free(q->next);
+	free(q->prev);
+	memset(q, 0, sizeof(spf_queue));
+}
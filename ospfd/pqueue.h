@@ -0,0 +1,68 @@
+#ifndef _PQUEUE_H
+#define _PQUEUE_H
+
+#include <stdint.h>
+
+/* Candidate list of the Dijkstra calculation (Section 16.1). The
+   candidate closest to the root is taken off the list at each
+   iteration, and the distance of a candidate can only decrease while
+   it is on the list. Two implementations are provided:
+
+   o An indexed binary heap, O(log V) per operation for any metric.
+
+   o A bucket queue (Dial's algorithm) with one bucket per possible
+     distance modulo the largest link metric. Since OSPF metrics are
+     small integers, this is O(1) per operation plus a scan over the
+     empty buckets.
+
+   The queue keeps its buffers between runs and only grows them when
+   the topology does. */
+
+#define SPF_QUEUE_HEAP   0
+#define SPF_QUEUE_BUCKET 1
+
+typedef struct spf_queue spf_queue;
+
+typedef struct spf_queue_ops{
+	const char *name;
+	/* empty the queue for a graph of num_vertex vertices whose links
+	   cost at most max_metric */
+	void (*reset)(spf_queue *q, int num_vertex, uint32_t max_metric);
+	/* insert vertex v, or lower its key if it is already queued */
+	void (*update)(spf_queue *q, int v, uint32_t key);
+	/* remove and return the vertex with the least key, -1 if empty */
+	int (*pop)(spf_queue *q);
+}spf_queue_ops;
+
+struct spf_queue{
+	const spf_queue_ops *ops;
+	int size;
+	int cap;
+	uint32_t *key;
+	/* heap: position of each vertex in heap[], -1 if not queued;
+	   bucket queue: 1 if queued, -1 otherwise */
+	int *pos;
+
+	/* indexed binary heap */
+	int *heap;
+
+	/* bucket queue */
+	int num_bucket;
+	int bucket_cap;
+	int *bucket;
+	int *next;
+	int *prev;
+	uint32_t cursor;
+};
+
+extern const spf_queue_ops spf_heap_ops;
+extern const spf_queue_ops spf_bucket_ops;
+
+void spf_queue_init(spf_queue *q, int type);
+void spf_queue_free(spf_queue *q);
+
+#define spf_queue_reset(q, n, m)  ((q)->ops->reset((q), (n), (m)))
+#define spf_queue_update(q, v, k) ((q)->ops->update((q), (v), (k)))
+#define spf_queue_pop(q)          ((q)->ops->pop(q))
+
+#endif
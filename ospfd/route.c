@@ -6,109 +6,311 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-void del_route_from_host(route *my_route){
-	static char cmd[128], ip[32], mask[32];
+/* the metric the backup path is installed with: above the primary
+   path, so that the host only uses it once the primary is gone */
+static uint16_t backup_metric(const route *my_route){
+	return my_route->backup_cost > my_route->cost ? my_route->backup_cost : my_route->cost + 1;
+}
+
+static void del_host_route(const route *my_route, in_addr_t gw, uint16_t metric){
+	static char cmd[160], ip[32], mask[32], next[32];
 	strcpy(ip, inet_ntoa((struct in_addr){my_route->dest_id}));
 	strcpy(mask, inet_ntoa((struct in_addr){my_route->addr_mask}));
-	sprintf(cmd, "route del -net %s netmask %s", ip, mask);
+	strcpy(next, inet_ntoa((struct in_addr){gw}));
+	sprintf(cmd, "route del -net %s netmask %s gw %s metric %hu", ip, mask, next, metric);
 	system(cmd);
 	printf("%s\n", cmd);
 }
 
-void add_route_to_host(route *my_route){
-	static char cmd[128], ip[32], mask[32], next[32];
+static void add_host_route(const route *my_route, in_addr_t gw, uint16_t metric, const char *iface){
+	static char cmd[160], ip[32], mask[32], next[32];
 	strcpy(ip, inet_ntoa((struct in_addr){my_route->dest_id}));
 	strcpy(mask, inet_ntoa((struct in_addr){my_route->addr_mask}));
-	strcpy(next, inet_ntoa((struct in_addr){my_route->next_hop}));
-	sprintf(cmd, "route add -net %s netmask %s gw %s metric %hu dev %s", ip, mask, next, my_route->cost, my_route->iface);
+	strcpy(next, inet_ntoa((struct in_addr){gw}));
+	sprintf(cmd, "route add -net %s netmask %s gw %s metric %hu dev %s", ip, mask, next, metric, iface);
 	system(cmd);
 	printf("%s\n", cmd);
 }
 
-void invalidated_old_routing_table(){
-	for(old_num_route = 0; old_num_route < num_route; old_num_route++){
-		old_routing_table[old_num_route] = routing_table[old_num_route];
-		del_route_from_host(&old_routing_table[old_num_route]);
+void del_route_from_host(route *my_route){
+	del_host_route(my_route, my_route->next_hop, my_route->cost);
+	if(my_route->backup_hop){
+		del_host_route(my_route, my_route->backup_hop, backup_metric(my_route));
 	}
-	num_route = 0;
-	for(int i = 0; i < num_area; i++){
-		areas[i].num_vertex = 0;
+}
+
+void add_route_to_host(route *my_route){
+	add_host_route(my_route, my_route->next_hop, my_route->cost, my_route->iface);
+	if(my_route->backup_hop){
+		add_host_route(my_route, my_route->backup_hop, backup_metric(my_route), my_route->backup_iface);
 	}
 }
 
-int lookup_route_by_dst(in_addr_t dest_id){
-	for(int i = 0; i < num_route; i++){
-		if(routing_table[i].dest_id == dest_id){
-			return i;
+/* The host changes of the last calculation: they are recorded with
+   lsdb_lock held and applied by apply_routing_table() after it is
+   released. The index of these tables is not used. */
+static route_table fib_del;
+static route_table fib_add;
+static char *fib_log;
+static size_t fib_log_len;
+
+/* Fast reroute: the routes whose primary next hop was the neighbor
+   lost their primary path on the host at once, so that the backup
+   path installed next to it takes over until the routing table is
+   calculated again. The entries are rewritten to what the host now
+   holds, so that the next sync_routes_to_host() sees the change.
+   fib_lock waits for the host to match the routing table first. */
+void route_neighbor_down(in_addr_t nbr_ip){
+	pthread_mutex_lock(&fib_lock);
+	for(int i = 0; i < routing_table.num; i++){
+		route *r = &routing_table.routes[i];
+		if(r->next_hop == nbr_ip && r->backup_hop && r->backup_hop != nbr_ip){
+			del_host_route(r, r->next_hop, r->cost);
+			r->cost = backup_metric(r);
+			r->next_hop = r->backup_hop;
+			r->iface = r->backup_iface;
+			r->backup_hop = 0;
+			r->backup_iface = NULL;
+			r->backup_cost = 0;
 		}
 	}
-	return -1;
+	pthread_mutex_unlock(&fib_lock);
 }
 
-int lookup_route_by_least_cost(){
-	int index = -1;
-	for(int i = 0; i < num_route; i++){
-		if(index == -1){
-			index = i;
+/* the current table becomes the old one, and the old one is emptied
+   for the next calculation */
+void invalidated_old_routing_table(){
+	route_table t = old_routing_table;
+	old_routing_table = routing_table;
+	routing_table = t;
+	routing_table.num = 0;
+	hash_index_clear(&routing_table.index);
+}
+
+/* room for at least num routes, so that merging does not reallocate */
+static void reserve_routes(route_table *t, int num){
+	if(num > t->max){
+		t->max = num;
+		t->routes = realloc(t->routes, t->max * sizeof(route));
+	}
+}
+
+/* the entry for dest_id, added empty if there is none */
+static route *put_route(route_table *t, in_addr_t dest_id){
+	route *r = lookup_route_by_dst(t, dest_id);
+	if(r != NULL){
+		return r;
+	}
+	if(t->num == t->max){
+		reserve_routes(t, t->max ? t->max * 2 : LIST_MAX);
+	}
+	hash_index_put(&t->index, HASH_KEY(0, dest_id), t->num);
+	r = &t->routes[t->num++];
+	memset(r, 0, sizeof(route));
+	r->dest_id = dest_id;
+	return r;
+}
+
+static void append_route(route_table *t, const route *r){
+	if(t->num == t->max){
+		reserve_routes(t, t->max ? t->max * 2 : LIST_MAX);
+	}
+	t->routes[t->num++] = *r;
+}
+
+static int same_iface(const char *a, const char *b){
+	return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+static int same_route(const route *a, const route *b){
+	return a->dest_id == b->dest_id && a->addr_mask == b->addr_mask && a->next_hop == b->next_hop &&
+		a->cost == b->cost && a->type2_cost == b->type2_cost && same_iface(a->iface, b->iface) && a->backup_hop == b->backup_hop &&
+		(a->backup_hop == 0 || (a->backup_cost == b->backup_cost && same_iface(a->backup_iface, b->backup_iface)));
+}
+
+/* Only the routes that differ between the old and the new routing
+   table are deleted from and added to the host. They are copied out
+   here and applied by apply_routing_table(). */
+static void sync_routes_to_host(){
+	for(int i = 0; i < old_routing_table.num; i++){
+		const route *old = &old_routing_table.routes[i];
+		const route *r = lookup_route_by_dst(&routing_table, old->dest_id);
+		if(r == NULL || !same_route(old, r)){
+			append_route(&fib_del, old);
 		}
-		else if(index > -1){
-			if(routing_table[i].cost < routing_table[index].cost || 
-				(routing_table[i].cost == routing_table[index].cost && 
-				routing_table[i].area_id > routing_table[index].area_id)){
-				index = i;
-			}
+	}
+	for(int j = 0; j < routing_table.num; j++){
+		const route *r = &routing_table.routes[j];
+		const route *old = lookup_route_by_dst(&old_routing_table, r->dest_id);
+		if(old == NULL || !same_route(old, r)){
+			append_route(&fib_add, r);
 		}
 	}
-	return index;
 }
 
-void update_routing_table(){
-	for(int i = 0; i < num_area; i++){
-		printf("\n-------------------------Routing table for Area %d---------------------------\n", areas[i].id);
-                printf("----------------------------------------------------------------------------\n");
-		shortest_path_tree(&areas[i]);
-                printf("Destination/Mask\t\tcost\tnext hop\n");
-		for(int j = 0; j < areas[i].num_vertex; j++){
-                        printf("%s/%s\t\t%d\t%s\n", inet_ntoa((struct in_addr){areas[i].vertices[j].id}), inet_ntoa((struct in_addr){areas[i].vertices[j].network_mask}), 
-                                areas[i].vertices[j].dist, inet_ntoa((struct in_addr){areas[i].vertices[j].next_hop}));
+route *lookup_route_by_dst(const route_table *t, in_addr_t dest_id){
+	int i = hash_index_get(&t->index, HASH_KEY(0, dest_id));
+	return (i == -1) ? NULL : &t->routes[i];
+}
+
+route *lookup_route_by_least_cost(const route_table *t){
+	route *best = NULL;
+	for(int i = 0; i < t->num; i++){
+		route *r = &t->routes[i];
+		if(best == NULL || r->cost < best->cost ||
+			(r->cost == best->cost && r->area_id > best->area_id)){
+			best = r;
 		}
-                printf("----------------------------------------------------------------------------\n\n");
-		for(int j = 0; j < areas[i].num_vertex; j++){
-			if(areas[i].vertices[j].network_mask && areas[i].vertices[j].dist < INF){
-				int route_index = lookup_route_by_dst(areas[i].vertices[j].id);
-				if(route_index == -1){
-					routing_table[num_route].addr_mask = areas[i].vertices[j].network_mask;
-					routing_table[num_route].dest_id = areas[i].vertices[j].id;
-					routing_table[num_route].next_hop = lookup_neighbor_ip_by_id(&areas[i], areas[i].vertices[j].next_hop);
-					routing_table[num_route].lsa = areas[i].vertices[j].lsa;
-					if(routing_table[num_route].next_hop){
-						routing_table[num_route].iface = lookup_ifname_by_ip(&areas[i], routing_table[num_route].next_hop);
-					}
-					else{
-						routing_table[num_route].iface = lookup_ifname_by_ip(&areas[i], routing_table[num_route].dest_id);
-					}
-					routing_table[num_route].cost = areas[i].vertices[j].dist;
-					add_route_to_host(&routing_table[num_route]);
-					num_route++;
+	}
+	return best;
+}
+
+static void print_vertices(FILE *out, const vertex *vertices, int num){
+	for(int j = 0; j < num; j++){
+                fprintf(out, "%s/%s\t\t%d\t%s\n", inet_ntoa((struct in_addr){vertices[j].id}), inet_ntoa((struct in_addr){vertices[j].network_mask}), 
+                        vertices[j].dist, inet_ntoa((struct in_addr){vertices[j].next_hop}));
+	}
+}
+
+/* Whether route r is preferred over route old for the same destination
+   (Section 16): intra-area paths over inter-area paths over type 1 and
+   then type 2 external paths, of type 2 external paths the least type
+   2 cost (Section 16.4 (6)), then the least cost, and of equal-cost
+   paths the one whose associated area has the largest Area ID. This
+   does not depend on the order the areas are merged in. */
+static int better_route(const route *r, const route *old){
+	if(r->path_type != old->path_type){
+		return r->path_type < old->path_type;
+	}
+	if(r->type2_cost != old->type2_cost){
+		return r->type2_cost < old->type2_cost;
+	}
+	if(r->cost != old->cost){
+		return r->cost < old->cost;
+	}
+	return r->area_id > old->area_id;
+}
+
+/* the path type of route r, and for a type 2 external path its type 2
+   cost; the cost of such a path is the distance to the AS boundary
+   router alone (see best_as_external_route()) */
+static void set_route_path_type(route *r, const vertex *v, int path_type){
+	r->path_type = path_type;
+	if(path_type == ROUTE_PATH_TYPE_ONE_EXTERNAL){
+		const as_external_lsa *aelsa = (const as_external_lsa *)((const uint8_t *)v->lsa +
+			sizeof(ospf_lsa_header));
+		if((ntohl(aelsa->tos0.tos0metric) >> 24) & AS_EXT_RTR_FLAFS_E){
+			r->path_type = ROUTE_PATH_TYPE_TWO_EXTERNAL;
+			r->type2_cost = ntohl(aelsa->tos0.tos0metric) & LSINFINITY;
+		}
+	}
+}
+
+static void add_vertex_routes(area *a, const vertex *vertices, int num, int path_type){
+	for(int j = 0; j < num; j++){
+		if(vertices[j].network_mask && vertices[j].dist < INF){
+			route r;
+			memset(&r, 0, sizeof(route));
+			r.addr_mask = vertices[j].network_mask;
+			r.dest_id = vertices[j].id;
+			r.area_id = a->id;
+			set_route_path_type(&r, &vertices[j], path_type);
+			r.next_hop = lookup_neighbor_ip_by_id(a, vertices[j].next_hop);
+			r.adv_router = vertices[j].lsa ? vertices[j].lsa->adv_router : 0;
+			r.lsa = vertices[j].lsa;
+			if(r.next_hop){
+				r.iface = lookup_ifname_by_ip(a, r.next_hop);
+			}
+			else{
+				r.iface = lookup_ifname_by_ip(a, r.dest_id);
+			}
+			r.cost = vertices[j].dist;
+			if(vertices[j].backup_hop && vertices[j].backup_dist < INF){
+				r.backup_hop = lookup_neighbor_ip_by_id(a, vertices[j].backup_hop);
+				if(r.backup_hop && r.backup_hop != r.next_hop){
+					r.backup_iface = lookup_ifname_by_ip(a, r.backup_hop);
+					r.backup_cost = vertices[j].backup_dist;
 				}
 				else{
-					if(routing_table[route_index].cost > areas[i].vertices[j].dist){
-						del_route_from_host(&routing_table[route_index]);
-						routing_table[route_index].addr_mask = areas[i].vertices[j].network_mask;
-						routing_table[route_index].dest_id = areas[i].vertices[j].id;
-						routing_table[route_index].next_hop = lookup_neighbor_ip_by_id(&areas[i], areas[i].vertices[j].next_hop);
-						routing_table[route_index].lsa = areas[i].vertices[j].lsa;
-						if(routing_table[route_index].next_hop){
-							routing_table[route_index].iface = lookup_ifname_by_ip(&areas[i], routing_table[route_index].next_hop);
-						}
-						else{
-							routing_table[route_index].iface = lookup_ifname_by_ip(&areas[i], routing_table[route_index].dest_id);
-						}
-						routing_table[route_index].cost = areas[i].vertices[j].dist;
-						add_route_to_host(&routing_table[route_index]);
-					}
+					r.backup_hop = 0;
 				}
 			}
+			route *old = lookup_route_by_dst(&routing_table, r.dest_id);
+			if(old == NULL){
+				*put_route(&routing_table, r.dest_id) = r;
+			}
+			else if(better_route(&r, old)){
+				*old = r;
+			}
+		}
+	}
+}
+
+static void area_spf_job(void *arg, int i){
+	shortest_path_tree(((area **)arg)[i]);
+}
+
+void update_routing_table(){
+	/* the areas whose database has changed are calculated in parallel;
+	   the others keep their routes */
+	area *dirty[NUM_AREA];
+	int num_dirty = 0;
+	for(int i = 0; i < num_area; i++){
+		if(areas[i].spf_dirty){
+			dirty[num_dirty++] = &areas[i];
 		}
 	}
+	thread_pool_run(&spf_pool, num_dirty, area_spf_job, dirty);
+
+	/* every destination of every area fits; there is no limit on the
+	   number of routes, externals included */
+	int num_dest = 0;
+	for(int i = 0; i < num_area; i++){
+		num_dest += areas[i].num_vertex + areas[i].inter.num + areas[i].external.num;
+	}
+	reserve_routes(&routing_table, num_dest);
+
+	/* the dump is printed with the host changes, outside lsdb_lock */
+	FILE *out = open_memstream(&fib_log, &fib_log_len);
+
+	for(int i = 0; i < num_area; i++){
+		area *a = &areas[i];
+		fprintf(out, "\n-------------------------Routing table for Area %d---------------------------\n", a->id);
+                fprintf(out, "----------------------------------------------------------------------------\n");
+                fprintf(out, "Destination/Mask\t\tcost\tnext hop\n");
+		print_vertices(out, a->vertices, a->num_vertex);
+		print_vertices(out, a->inter.entries, a->inter.num);
+		print_vertices(out, a->external.entries, a->external.num);
+                fprintf(out, "----------------------------------------------------------------------------\n\n");
+		/* intra-area, inter-area and then external routes (Sections 16.2-16.4) */
+		add_vertex_routes(a, a->vertices, a->num_vertex, ROUTE_PATH_TYPE_INTRA_AREA);
+		add_vertex_routes(a, a->inter.entries, a->inter.num, ROUTE_PATH_TYPE_INTER_AREA);
+		add_vertex_routes(a, a->external.entries, a->external.num, ROUTE_PATH_TYPE_ONE_EXTERNAL);
+	}
+	int num_type[ROUTE_PATH_TYPE_TWO_EXTERNAL + 1] = {0};
+	for(int i = 0; i < routing_table.num; i++){
+		num_type[routing_table.routes[i].path_type]++;
+	}
+	fprintf(out, "%d routes: %d intra-area, %d inter-area, %d type 1 external, %d type 2 external\n",
+		routing_table.num, num_type[ROUTE_PATH_TYPE_INTRA_AREA], num_type[ROUTE_PATH_TYPE_INTER_AREA],
+		num_type[ROUTE_PATH_TYPE_ONE_EXTERNAL], num_type[ROUTE_PATH_TYPE_TWO_EXTERNAL]);
+	fclose(out);
+	sync_routes_to_host();
+}
+
+/* Print the last calculation and bring the host in line with it. The
+   caller holds fib_lock but not lsdb_lock, so that packets are
+   processed while the route commands run. */
+void apply_routing_table(){
+	fwrite(fib_log, 1, fib_log_len, stdout);
+	free(fib_log);
+	fib_log = NULL;
+	for(int i = 0; i < fib_del.num; i++){
+		del_route_from_host(&fib_del.routes[i]);
+	}
+	for(int i = 0; i < fib_add.num; i++){
+		add_route_to_host(&fib_add.routes[i]);
+	}
+	fib_del.num = 0;
+	fib_add.num = 0;
 }
@@ -2,6 +2,7 @@
 #define _ROUTING_TABLE_H
 
 #include "ospf_packets.h"
+#include "hash.h"
 #include "shared.h"
 #include <netinet/in.h>
 
@@ -110,6 +111,7 @@ typedef struct route{
       the cost of the portion of the path internal to the AS. This
       cost is calculated as the sum of the costs of the path’s
       constituent links. */
+   uint16_t cost;
 
    /* Type 2 cost - 
       Only valid for type 2 external paths. For these paths, this
@@ -119,7 +121,7 @@ typedef struct route{
       type 2 external path with type 2 cost of 5 is always preferred
       over a path with type 2 cost of 10, regardless of the cost of
       the two paths’ internal components. */
-   uint16_t cost;
+   uint32_t type2_cost;
 
    /* Link State Origin - 
       Valid only for intra-area paths, this field indicates the LSA
@@ -155,8 +157,28 @@ typedef struct route{
    uint32_t adv_router;
 
 	const char *iface;
+
+   /* Backup next hop - 
+      A loop-free alternate (RFC 5286) installed next to the primary
+      path with a larger metric, so that the host keeps forwarding
+      through it as soon as the primary next hop is lost, and its
+      interface and cost. backup_hop is 0 if there is none. */
+	in_addr_t backup_hop;
+	const char *backup_iface;
+	uint16_t backup_cost;
 }route;
 
+/* The routing table: one entry per Destination ID, found through index
+   by HASH_KEY(0, Destination ID). It grows with the number of
+   destinations, so that every AS external route calculated can be
+   installed. */
+typedef struct route_table{
+	int num;
+	int max;
+	route *routes;
+	hash_index index;
+}route_table;
+
 
 /* 11.1. Routing table lookup */
 /* When an IP data packet is received, an OSPF router finds the
@@ -196,8 +218,10 @@ typedef struct route{
    be returned to the packet’s source. */
 
 void invalidated_old_routing_table();
-int lookup_route_by_dst(in_addr_t dest_id);
-int lookup_route_by_least_cost();
+route *lookup_route_by_dst(const route_table *t, in_addr_t dest_id);
+route *lookup_route_by_least_cost(const route_table *t);
+void route_neighbor_down(in_addr_t nbr_ip);
 void update_routing_table();
+void apply_routing_table();
 
 #endif
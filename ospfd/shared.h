@@ -1,11 +1,12 @@
 #ifndef _SHARED_H
 #define _SHARED_H
 
-#define BUFFER_SIZE	2048
+/* the packet buffers hold an IP datagram of a jumbo frame link; no
+   interface MTU is taken to be larger */
+#define BUFFER_SIZE	9216
 
 #define NUM_AREA 256
 #define NUM_INTERFACE 256
-#define NUM_ROUTE 256
 
 #define IF_NAMESIZE 16
 
@@ -75,6 +76,8 @@
 #define	OSPF_DEFAULT_ROUTER_PRIORITY 1
 #define	OSPF_DEFAULT_ROUTER_DEAD_INTERVAL 40
 #define OSPF_DEFAULT_RXMT_INTERVAL 5
+/* seconds delayed acknowledgments wait to be sent together */
+#define OSPF_DEFAULT_ACK_DELAY 1
 
 /* MaxAge for LSA */
 /* The value of MaxAge is set to 1 hour. */
@@ -82,6 +85,9 @@
 /* MaxAgeDiff for LSA */
 /* The value of MaxAgeDiff is set to 15 minutes. */
 #define MAX_AGE_DIFF 900
+/* LSRefreshTime for LSA */
+/* A self-originated LSA is refreshed every 30 minutes. */
+#define LS_REFRESH_TIME 1800
 
 #define RTR_LSA_FLAGS_V 0x04
 #define RTR_LSA_FLAGS_E 0x02
@@ -97,13 +103,64 @@
 #define RTR_LSA_STUB        3
 #define RTR_LSA_VIRTUAL     4
 
-/* Maximum transmission unit (btye) */
+/* Maximum transmission unit (btye), for interfaces whose MTU can not
+   be read */
 #define DEFAULT_MTU 1500
 
+/* bounds of the retransmission timeout estimated for each neighbor
+   (milliseconds), see rtt_sample() */
+#define RTO_DEFAULT_MIN 20
+#define RTO_DEFAULT_MAX 30000
+
+/* at most ADJ_DEFAULT_MAX_BRINGUP adjacencies in ExStart, Exchange or
+   Loading at once, started at least ADJ_DEFAULT_START_GAP milliseconds
+   apart, see adj_admit() */
+#define ADJ_DEFAULT_MAX_BRINGUP 8
+#define ADJ_DEFAULT_START_GAP 50
+
+/* pacing of the neighbors' transmit queues (see tx_queue): at least
+   TX_DEFAULT_MIN_GAP milliseconds between packets, at most
+   TX_DEFAULT_MAX_BURST packets in TX_DEFAULT_BURST_INTERVAL
+   milliseconds, TX_DEFAULT_QUEUE_MAX packets waiting */
+#define TX_DEFAULT_MIN_GAP 2
+#define TX_DEFAULT_MAX_BURST 16
+#define TX_DEFAULT_BURST_INTERVAL 100
+#define TX_DEFAULT_QUEUE_MAX 64
+
+/* milliseconds newly installed LSAs wait to be flooded together */
+#define FLOOD_DEFAULT_DELAY 100
+
+/* Link State Update packets a neighbor may have outstanding, see
+   lsu_window_open() */
+#define LSU_DEFAULT_MAX_IN_FLIGHT 8
+
 /* for shortest path tree */
 #define NUM_VERTEX 256
 #define INF 0x7fff
 
+/* for incremental shortest path tree: beyond this many changed
+   router/network LSAs, or once more than 1/SPF_INCREMENTAL_MAX_RATIO of
+   the tree has to be rebuilt, the full calculation is run instead */
+#define SPF_INCREMENTAL_MAX_CHANGES 16
+#define SPF_INCREMENTAL_MAX_RATIO 4
+
+/* SPF throttling (milliseconds): the routing table is calculated
+   SPF_DEFAULT_INITIAL_DELAY after the first change to a quiet database,
+   and no sooner than the hold time after the previous calculation. The
+   hold time doubles while changes keep coming, up to SPF_DEFAULT_MAX_WAIT. */
+#define SPF_DEFAULT_INITIAL_DELAY 50
+#define SPF_DEFAULT_HOLD_TIME 200
+#define SPF_DEFAULT_MAX_WAIT 5000
+
+/* areas of at least this many transit vertices run the parallel SPF
+   calculation when the worker threads are idle; 0, never, unless it
+   is configured, as it only pays off with several free cores */
+#define SPF_DEFAULT_PARALLEL_THRESHOLD 0
+
+/* number of shortest-path trees remembered per area for topologies
+   that come back after a link flap */
+#define SPF_MEMO_ENTRIES 4
+
 /* for area address state */
 #define ADVERTISE 1
 #define NONADVERTISE 0
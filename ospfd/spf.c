@@ -1,102 +1,961 @@
 #include "spf.h"
+#include "lsa.h"
 #include "ospfd.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
 
-void dijkstra(area *a, int root){
-	vertex *leaf = a->vertices + a->num_vertex;
-	int use[NUM_VERTEX];
-	int pre[NUM_VERTEX];
-	a->vertices[root].dist = 0;
-	pre[root] = root;
-	while(1){
-		int p = -1, q;
-		/* find out the nearest unused node */
-		for(int j = 0; j < a->num_vertex; j++){
-			if (!use[j] && (p == -1 || a->vertices[p].dist > a->vertices[j].dist))
-				p = j;
-		}
-		if(p == -1 || a->vertices[p].dist == INF){
-			break;
+/* find the transit vertex a decoded link points at: transit links lead
+   to network vertices, everything else to router vertices */
+static int lookup_link_vertex(const area *a, const spf_link *lnk){
+	uint8_t ls_type = (lnk->type == RTR_LSA_TRANSIT) ? OSPF_NETWORK_LSA : OSPF_ROUTER_LSA;
+	return hash_index_get(&a->vertex_index, HASH_KEY(ls_type, lnk->id));
+}
+
+static void reserve_spf_buffers(area *a, int num){
+	if(num <= a->spf_cap){
+		return ;
+	}
+	a->spf_dist = realloc(a->spf_dist, num * sizeof(int));
+	a->spf_key = realloc(a->spf_key, num * sizeof(uint64_t));
+	a->spf_use = realloc(a->spf_use, num * sizeof(int));
+	a->spf_pre = realloc(a->spf_pre, num * sizeof(int));
+	a->spf_child = realloc(a->spf_child, num * sizeof(int));
+	a->spf_sibling = realloc(a->spf_sibling, num * sizeof(int));
+	a->spf_stack = realloc(a->spf_stack, num * sizeof(int));
+	a->spf_leaf = realloc(a->spf_leaf, (num + 1) * sizeof(int));
+	a->spf_cap = num;
+}
+
+static void graph_reserve(spf_graph *g, int num_vertex, int num_edge){
+	if(num_vertex > g->max_vertex){
+		g->max_vertex = num_vertex * 2;
+		g->start = realloc(g->start, (g->max_vertex + 1) * sizeof(int));
+	}
+	if(num_edge > g->max_edge){
+		g->max_edge = num_edge * 2;
+		g->to = realloc(g->to, g->max_edge * sizeof(int));
+		g->metric = realloc(g->metric, g->max_edge * sizeof(uint16_t));
+	}
+}
+
+/* append the row of transit vertex v, resolved from its decoded LSA */
+static void graph_add_row(area *a, spf_graph *g, int v){
+	const lsa_vec *vec = a->vertices[v].vec;
+	graph_reserve(g, v + 1, g->num_edge + vec->num_link);
+	for(const spf_link *lnk = vec->links; lnk < vec->links + vec->num_link; lnk++){
+		if((lnk->type != RTR_LSA_ROUTER && lnk->type != RTR_LSA_TRANSIT) || !lnk->back_link){
+			continue;
 		}
-		use[p] = 1;
-		/* update distance of the rest nodes */
-		if(a->vertices[p].lsa->ls_type == OSPF_ROUTER_LSA){
-			router_lsa *rtr_lsa = (router_lsa *)((uint8_t *)a->vertices[p].lsa + 
-				sizeof(ospf_lsa_header));
-			int j = ntohs(rtr_lsa->num_link);
-			a->vertices[p].network_mask = 0;
-			for(const mylink *lnk = rtr_lsa->links; j--; lnk++){
-				int k = a->num_vertex;
-				if(lnk->type == RTR_LSA_ROUTER || lnk->type == RTR_LSA_TRANSIT){
-					k = lookup_vertex_by_id(a, lnk->id);
-				}
-				else{
-					if(lnk->type == RTR_LSA_STUB){
-						printf("leaf: %s\n", inet_ntoa((struct in_addr){lnk->id}));
-						leaf->id = lnk->id;
-						leaf->network_mask = lnk->data;
-						leaf->next_hop = a->vertices[p].next_hop;
-						leaf->dist = a->vertices[p].dist + ntohs(lnk->metric);
-						leaf->lsa = a->vertices[p].lsa;
-						pre[leaf - a->vertices] = p;
-						leaf++;
-				    }
-				    continue;
-				}
-				if(k == a->num_vertex || use[k]){
-					continue;
-				}
-				int det = ntohs(lnk->metric);
-				if(a->vertices[k].dist > a->vertices[p].dist + det){
-					a->vertices[k].dist = a->vertices[p].dist + det;
-					pre[k] = p;
+		int k = lookup_link_vertex(a, lnk);
+		if(k != -1){
+			g->to[g->num_edge] = k;
+			g->metric[g->num_edge] = lnk->metric;
+			g->num_edge++;
+		}
+	}
+}
+
+/* Build a->graph for the first a->num_transit vertices. Unless full is
+   set, the rows of vertices that were already in the previous graph
+   and are not in a->graph_dirty are copied over as they are. */
+static void build_graph(area *a, int full){
+	spf_graph *old = &a->graph;
+	spf_graph *g = &a->graph_spare;
+	int n = a->num_transit;
+	g->num_vertex = n;
+	g->num_edge = 0;
+	graph_reserve(g, n, old->num_edge);
+	for(int v = 0; v < n; v++){
+		g->start[v] = g->num_edge;
+		if(!full && v < old->num_vertex &&
+			hash_index_get(&a->graph_dirty.index, a->spf_key[v]) == -1){
+			int len = old->start[v + 1] - old->start[v];
+			graph_reserve(g, n, g->num_edge + len);
+			memcpy(g->to + g->num_edge, old->to + old->start[v], len * sizeof(int));
+			memcpy(g->metric + g->num_edge, old->metric + old->start[v], len * sizeof(uint16_t));
+			g->num_edge += len;
+		}
+		else{
+			graph_add_row(a, g, v);
+		}
+	}
+	g->start[n] = g->num_edge;
+	spf_graph tmp = *old;
+	*old = *g;
+	*g = tmp;
+	key_set_clear(&a->graph_dirty);
+}
+
+/* Whether the path through p of length dist beats the current path to
+   k. Equal-cost paths are decided on the parent's type and Vertex ID,
+   so the full and the incremental calculation always agree on the tree
+   (and therefore on the next hops). */
+static int better_path(const area *a, int dist, int p, int k){
+	if(dist >= INF || dist > a->spf_dist[k]){
+		return OSPFD_FALSE;
+	}
+	if(dist < a->spf_dist[k] || a->spf_pre[k] == -1){
+		return OSPFD_TRUE;
+	}
+	return a->spf_key[p] < a->spf_key[a->spf_pre[k]];
+}
+
+/* cost of the (two-way) link from vertex u to vertex v, -1 if none */
+static int link_cost(const area *a, int u, int v){
+	const spf_graph *g = &a->graph;
+	int cost = -1;
+	for(int e = g->start[u]; e < g->start[u + 1]; e++){
+		if(g->to[e] == v && (cost == -1 || g->metric[e] < cost)){
+			cost = g->metric[e];
+		}
+	}
+	return cost;
+}
+
+static void relax_links(area *a, int p){
+	const spf_graph *g = &a->graph;
+	int dist_p = a->spf_dist[p];
+	for(int e = g->start[p]; e < g->start[p + 1]; e++){
+		int k = g->to[e];
+		if(k == a->spf_root || a->spf_use[k]){
+			continue;
+		}
+		int dist = dist_p + g->metric[e];
+		if(better_path(a, dist, p, k)){
+			if(dist < a->spf_dist[k]){
+				a->spf_dist[k] = dist;
+				spf_queue_update(&a->queue, k, dist);
+			}
+			a->spf_pre[k] = p;
+		}
+	}
+}
+
+static uint32_t max_link_metric(const area *a){
+	uint32_t max_metric = 0;
+	for(int e = 0; e < a->graph.num_edge; e++){
+		if(a->graph.metric[e] > max_metric){
+			max_metric = a->graph.metric[e];
+		}
+	}
+	return max_metric;
+}
+
+/* Delta-stepping (Meyer and Sanders) for large areas, run on spf_pool.
+   Candidates are kept in buckets of width delta. The vertices of the
+   lowest non-empty bucket are relaxed in parallel along their light
+   links (metric <= delta) until the bucket stays empty, and then along
+   their heavy links once. Distances are lowered with compare-and-swap.
+   The parents are chosen afterwards, with the same tie-break on the
+   parent's key as better_path(). The result is therefore the same tree
+   as the sequential calculation. */
+#define DELTA_LIGHT 0
+#define DELTA_HEAVY 1
+#define DELTA_PARENT 2
+/* below this many vertices a step is not split up */
+#define DELTA_MIN_CHUNK 64
+
+/* vertices v[i] queued for bucket b[i] by one job */
+typedef struct delta_list{
+	int num;
+	int max;
+	int *v;
+	int *b;
+}delta_list;
+
+typedef struct delta_step{
+	area *a;
+	int delta;
+	int phase;
+	/* queued[v] is 1 + the bucket vertex v waits in, 0 if none */
+	int *queued;
+	const int *items;
+	int num_item;
+	int num_chunk;
+	delta_list *out;
+}delta_step;
+
+static void delta_list_add(delta_list *l, int v, int b){
+	if(l->num == l->max){
+		l->max = l->max ? l->max * 2 : 64;
+		l->v = realloc(l->v, l->max * sizeof(int));
+		l->b = realloc(l->b, l->max * sizeof(int));
+	}
+	l->v[l->num] = v;
+	l->b[l->num] = b;
+	l->num++;
+}
+
+static void delta_relax(delta_step *s, delta_list *out, int p){
+	area *a = s->a;
+	const spf_graph *g = &a->graph;
+	if(s->phase == DELTA_LIGHT){
+		/* taken off its bucket before its distance is read, so that a
+		   later improvement queues it again */
+		__atomic_store_n(&s->queued[p], 0, __ATOMIC_SEQ_CST);
+	}
+	int dist_p = __atomic_load_n(&a->spf_dist[p], __ATOMIC_SEQ_CST);
+	for(int e = g->start[p]; e < g->start[p + 1]; e++){
+		if((g->metric[e] > s->delta) != (s->phase == DELTA_HEAVY)){
+			continue;
+		}
+		int k = g->to[e];
+		int dist = dist_p + g->metric[e];
+		if(dist >= INF){
+			continue;
+		}
+		int old = __atomic_load_n(&a->spf_dist[k], __ATOMIC_SEQ_CST);
+		while(dist < old && !__atomic_compare_exchange_n(&a->spf_dist[k], &old, dist,
+			OSPFD_FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+		if(dist >= old){
+			continue;
+		}
+		int b = dist / s->delta;
+		int q = __atomic_load_n(&s->queued[k], __ATOMIC_SEQ_CST);
+		while((q == 0 || q - 1 > b) && !__atomic_compare_exchange_n(&s->queued[k], &q, b + 1,
+			OSPFD_FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+		if(q == 0 || q - 1 > b){
+			delta_list_add(out, k, b);
+		}
+	}
+}
+
+/* keep the least-keyed parent among the links on a shortest path */
+static void delta_parent(area *a, int p){
+	const spf_graph *g = &a->graph;
+	if(a->spf_dist[p] >= INF){
+		return ;
+	}
+	for(int e = g->start[p]; e < g->start[p + 1]; e++){
+		int k = g->to[e];
+		if(k == a->spf_root || a->spf_dist[p] + g->metric[e] != a->spf_dist[k]){
+			continue;
+		}
+		int q = __atomic_load_n(&a->spf_pre[k], __ATOMIC_SEQ_CST);
+		while((q == -1 || a->spf_key[p] < a->spf_key[q]) &&
+			!__atomic_compare_exchange_n(&a->spf_pre[k], &q, p,
+			OSPFD_FALSE, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+	}
+}
+
+static void delta_job(void *arg, int i){
+	delta_step *s = arg;
+	int from = (long)s->num_item * i / s->num_chunk;
+	int to = (long)s->num_item * (i + 1) / s->num_chunk;
+	for(int j = from; j < to; j++){
+		if(s->phase == DELTA_PARENT){
+			delta_parent(s->a, j);
+		}
+		else{
+			delta_relax(s, &s->out[i], s->items[j]);
+		}
+	}
+}
+
+static void delta_run(delta_step *s, int phase, const int *items, int num_item){
+	s->phase = phase;
+	s->items = items;
+	s->num_item = num_item;
+	s->num_chunk = (num_item + DELTA_MIN_CHUNK - 1) / DELTA_MIN_CHUNK;
+	if(s->num_chunk > spf_pool.num_thread + 1){
+		s->num_chunk = spf_pool.num_thread + 1;
+	}
+	for(int i = 0; i < s->num_chunk; i++){
+		s->out[i].num = 0;
+	}
+	thread_pool_run(&spf_pool, s->num_chunk, delta_job, s);
+}
+
+static void delta_stepping(area *a, int root, int delta){
+	int n = a->num_transit;
+	int num_bucket = INF / delta + 1;
+	delta_step s;
+	s.a = a;
+	s.delta = delta;
+	s.queued = calloc(n, sizeof(int));
+	s.out = calloc(spf_pool.num_thread + 1, sizeof(delta_list));
+	/* the later buckets: the entries of bucket b are chained from
+	   head[b], entries.b[] holding the next entry */
+	int *head = malloc(num_bucket * sizeof(int));
+	memset(head, 0xff, num_bucket * sizeof(int));
+	delta_list entries = {0, 0, NULL, NULL};
+	int *cur = malloc(n * sizeof(int));
+	int *settled = malloc(n * sizeof(int));
+
+	a->spf_dist[root] = 0;
+	a->spf_pre[root] = root;
+	s.queued[root] = 1;
+	int num_cur = 1;
+	cur[0] = root;
+	for(int b = 0; b < num_bucket; b++){
+		if(b > 0){
+			num_cur = 0;
+			for(int j = head[b]; j != -1; j = entries.b[j]){
+				int v = entries.v[j];
+				/* skip the entries of vertices that have moved since */
+				if(s.queued[v] == b + 1){
+					cur[num_cur++] = v;
 				}
 			}
-		} 
-		else if(a->vertices[p].lsa->ls_type == OSPF_NETWORK_LSA){
-			network_lsa *net_lsa = (network_lsa *)((uint8_t *)a->vertices[p].lsa + 
-				sizeof(ospf_lsa_header));
-			int j = (ntohs(a->vertices[p].lsa->length) - sizeof(ospf_lsa_header) - 
-				sizeof(net_lsa->network_mask)) /sizeof(in_addr_t);
-			a->vertices[p].network_mask = net_lsa->network_mask;
-			for(const in_addr_t *rtr = net_lsa->attached_rtrs; j--; rtr++){
-				int k = lookup_vertex_by_id(a, *rtr);
-				if(k == a->num_vertex || use[k]){
-					continue;
+		}
+		int num_settled = 0;
+		while(num_cur > 0){
+			for(int j = 0; j < num_cur; j++){
+				if(!a->spf_use[cur[j]]){
+					a->spf_use[cur[j]] = 1;
+					settled[num_settled++] = cur[j];
 				}
-				router_lsa *rtr_lsa = (router_lsa *)((uint8_t *)a->vertices[k].lsa + 
-					sizeof(ospf_lsa_header));
-				int num = ntohs(rtr_lsa->num_link);
-				while(num--){
-					if(rtr_lsa->links[num].type == RTR_LSA_TRANSIT &&
-						rtr_lsa->links[num].id == a->vertices[p].id){
-						break;
+			}
+			delta_run(&s, DELTA_LIGHT, cur, num_cur);
+			num_cur = 0;
+			for(int i = 0; i < s.num_chunk; i++){
+				for(int j = 0; j < s.out[i].num; j++){
+					int v = s.out[i].v[j];
+					int vb = s.out[i].b[j];
+					if(vb == b){
+						/* only one entry of v can be current */
+						if(s.queued[v] == b + 1){
+							cur[num_cur++] = v;
+						}
 					}
-					if(rtr_lsa->links[num].type == RTR_LSA_STUB && 
-						rtr_lsa->links[num].id == (a->vertices[p].id & net_lsa->network_mask)){
-						break;
+					else{
+						delta_list_add(&entries, v, head[vb]);
+						head[vb] = entries.num - 1;
 					}
 				}
-				if(num < 0){
-					continue;
-				}
-				int det = ntohs(rtr_lsa->links[num].metric);
-				if(a->vertices[k].dist > a->vertices[p].dist + det){
-					a->vertices[k].dist = a->vertices[p].dist + det;
-					pre[k] = p;
-				}
 			}
 		}
-		/* calculate the next router id */
-		for(q = p; q != root; q = pre[q]){
-			if(!a->vertices[q].network_mask){
-				a->vertices[p].next_hop = a->vertices[q].id;
+		if(num_settled == 0){
+			continue;
+		}
+		delta_run(&s, DELTA_HEAVY, settled, num_settled);
+		for(int i = 0; i < s.num_chunk; i++){
+			for(int j = 0; j < s.out[i].num; j++){
+				int vb = s.out[i].b[j];
+				delta_list_add(&entries, s.out[i].v[j], head[vb]);
+				head[vb] = entries.num - 1;
+			}
+		}
+	}
+	delta_run(&s, DELTA_PARENT, NULL, n);
+
+	for(int i = 0; i <= spf_pool.num_thread; i++){
+		free(s.out[i].v);
+		free(s.out[i].b);
+	}
+	free(s.out);
+	free(s.queued);
+	free(head);
+	free(entries.v);
+	free(entries.b);
+	free(cur);
+	free(settled);
+}
+
+/* the first stage of Section 16.1, over the transit vertices only */
+void dijkstra(area *a, int root){
+	int num_transit = a->num_transit;
+	reserve_spf_buffers(a, num_transit);
+	memset(a->spf_use, 0, num_transit * sizeof(int));
+	memset(a->spf_pre, 0xff, num_transit * sizeof(int));
+	for(int i = 0; i < num_transit; i++){
+		a->spf_dist[i] = INF;
+	}
+	/* Links of metric 0 could make the parents of vertices at the same
+	   distance depend on the order they are taken off the list, so such
+	   graphs stay with the sequential calculation. So does an area
+	   calculated alongside others, as a job of spf_pool, or while the
+	   pool is busy: its steps would only be run one after the other by
+	   the calling thread, slower than the sequential calculation. */
+	if(spf_parallel_threshold > 0 && num_transit >= spf_parallel_threshold &&
+		a->graph.num_edge > 0 && thread_pool_idle(&spf_pool)){
+		long sum = 0;
+		int min_metric = INF;
+		for(int e = 0; e < a->graph.num_edge; e++){
+			sum += a->graph.metric[e];
+			if(a->graph.metric[e] < min_metric){
+				min_metric = a->graph.metric[e];
+			}
+		}
+		if(min_metric > 0){
+			/* a bucket as wide as the average link */
+			delta_stepping(a, root, sum / a->graph.num_edge);
+			return ;
+		}
+	}
+	if(a->queue.ops == NULL){
+		spf_queue_init(&a->queue, spf_queue_type);
+	}
+	spf_queue_reset(&a->queue, num_transit, max_link_metric(a));
+
+	a->spf_dist[root] = 0;
+	a->spf_pre[root] = root;
+	spf_queue_update(&a->queue, root, 0);
+	int p;
+	/* take the nearest candidate off the list */
+	while((p = spf_queue_pop(&a->queue)) != -1){
+		a->spf_use[p] = 1;
+		relax_links(a, p);
+	}
+}
+
+static void invalidate_subtree(area *a, int r, int *num_invalid){
+	int *stack = a->spf_stack;
+	int top = 0;
+	if(a->spf_use[r]){
+		return ;
+	}
+	stack[top++] = r;
+	a->spf_use[r] = 1;
+	while(top > 0){
+		int v = stack[--top];
+		a->spf_dist[v] = INF;
+		a->spf_pre[v] = -1;
+		(*num_invalid)++;
+		for(int c = a->spf_child[v]; c != -1; c = a->spf_sibling[c]){
+			if(!a->spf_use[c]){
+				a->spf_use[c] = 1;
+				stack[top++] = c;
+			}
+		}
+	}
+}
+
+/* Look for the best path to v over its incoming links from vertices
+   whose distance is still valid, and make v a candidate if it
+   improves. The incoming links of v are the links of v itself that
+   have a back-link. */
+static void seed_vertex(area *a, int v){
+	const spf_graph *g = &a->graph;
+	if(v == a->spf_root){
+		return ;
+	}
+	for(int e = g->start[v]; e < g->start[v + 1]; e++){
+		int u = g->to[e];
+		if(a->spf_use[u] || a->spf_dist[u] >= INF){
+			continue;
+		}
+		int cost = link_cost(a, u, v);
+		if(cost == -1){
+			continue;
+		}
+		int dist = a->spf_dist[u] + cost;
+		if(better_path(a, dist, u, v)){
+			a->spf_dist[v] = dist;
+			a->spf_pre[v] = u;
+			spf_queue_update(&a->queue, v, dist);
+		}
+	}
+}
+
+/* Repair the previous tree after the LSAs listed in a->spf_changes have
+   been installed, in the manner of Ramalingam and Reps: the subtrees
+   hanging off tree links that were removed or became more expensive
+   are cut off, their vertices (and the changed vertices and their
+   neighbors) are offered the best path from the intact part of the
+   tree, and Dijkstra then runs over those candidates only. Returns
+   FAILURE when the change is too large to be worth repairing. */
+static int incremental_dijkstra(area *a){
+	int old_transit = a->num_transit;
+	int n = 0;
+
+	/* The LSAs may have been moved by install_lsa(). The vertices keep
+	   the order of the database, newly installed LSAs come last. */
+	for(int i = 0; i < a->num_lsa; i++){
+		if(a->vecs[i] == NULL){
+			continue;
+		}
+		if(n >= old_transit){
+			area_reserve_vertices(a, n + 1);
+			reserve_spf_buffers(a, n + 1);
+			a->vertices[n].id = a->lsas[i]->link_state_id;
+			a->spf_dist[n] = INF;
+			a->spf_key[n] = HASH_KEY(a->vecs[i]->ls_type, a->vertices[n].id);
+			a->spf_pre[n] = -1;
+			hash_index_put(&a->vertex_index, HASH_KEY(a->vecs[i]->ls_type, a->vertices[n].id), n);
+		}
+		/* a router and a network may share an ID (a Designated Router
+		   whose interface address is its Router ID), so the LS type
+		   has to match as well */
+		else if(a->spf_key[n] != HASH_KEY(a->vecs[i]->ls_type, a->lsas[i]->link_state_id)){
+			return FAILURE;
+		}
+		a->vertices[n].lsa = a->lsas[i];
+		a->vertices[n].vec = a->vecs[i];
+		n++;
+	}
+	a->num_transit = a->num_vertex = n;
+	build_graph(a, OSPFD_FALSE);
+
+	int *use = a->spf_use;
+	int *pre = a->spf_pre;
+	memset(use, 0, n * sizeof(int));
+	for(int v = 0; v < n; v++){
+		a->spf_child[v] = -1;
+	}
+	for(int v = 0; v < n; v++){
+		if(v != a->spf_root && pre[v] != -1){
+			a->spf_sibling[v] = a->spf_child[pre[v]];
+			a->spf_child[pre[v]] = v;
+		}
+	}
+
+	/* cut off the subtrees below tree links that no longer hold; use[]
+	   marks the vertices that lost their distance */
+	int num_invalid = 0;
+	for(int i = 0; i < a->num_spf_change; i++){
+		int x = hash_index_get(&a->vertex_index, a->spf_changes[i]);
+		if(x == -1){
+			continue;
+		}
+		if(x != a->spf_root && pre[x] != -1){
+			int cost = link_cost(a, pre[x], x);
+			if(cost == -1 || a->spf_dist[pre[x]] + cost > a->spf_dist[x]){
+				invalidate_subtree(a, x, &num_invalid);
+			}
+		}
+		for(int c = a->spf_child[x]; c != -1; c = a->spf_sibling[c]){
+			int cost = link_cost(a, x, c);
+			if(cost == -1 || a->spf_dist[x] + cost > a->spf_dist[c]){
+				invalidate_subtree(a, c, &num_invalid);
+			}
+		}
+	}
+	if(num_invalid * SPF_INCREMENTAL_MAX_RATIO > n){
+		return FAILURE;
+	}
+
+	/* the candidate list may now span the whole metric range */
+	if(a->queue.ops == NULL){
+		spf_queue_init(&a->queue, spf_queue_type);
+	}
+	spf_queue_reset(&a->queue, n, INF);
+	for(int v = 0; v < n; v++){
+		if(use[v]){
+			seed_vertex(a, v);
+		}
+	}
+	for(int i = 0; i < a->num_spf_change; i++){
+		int x = hash_index_get(&a->vertex_index, a->spf_changes[i]);
+		if(x == -1 || use[x]){
+			continue;
+		}
+		seed_vertex(a, x);
+		for(int e = a->graph.start[x]; e < a->graph.start[x + 1]; e++){
+			if(!use[a->graph.to[e]]){
+				seed_vertex(a, a->graph.to[e]);
+			}
+		}
+	}
+
+	/* from here on use[] marks the vertices taken off the candidate list */
+	memset(use, 0, n * sizeof(int));
+	int p;
+	while((p = spf_queue_pop(&a->queue)) != -1){
+		use[p] = 1;
+		relax_links(a, p);
+	}
+	return SUCCESS;
+}
+
+/* 16.1.1. The next hop of a vertex is the first router on the path from
+   the root, and is inherited by everything below it in the tree. */
+static void calculate_next_hops(area *a){
+	int *done = a->spf_use;
+	int *stack = a->spf_stack;
+	memset(done, 0, a->num_transit * sizeof(int));
+	done[a->spf_root] = 1;
+	a->vertices[a->spf_root].next_hop = 0;
+	for(int i = 0; i < a->num_transit; i++){
+		int top = 0;
+		for(int v = i; !done[v]; v = a->spf_pre[v]){
+			done[v] = 1;
+			if(a->spf_pre[v] == -1){
+				a->vertices[v].next_hop = 0;
+				break;
+			}
+			stack[top++] = v;
+		}
+		while(top > 0){
+			vertex *v = &a->vertices[stack[--top]];
+			int u = a->spf_pre[v - a->vertices];
+			v->next_hop = (u == a->spf_root) ? 0 : a->vertices[u].next_hop;
+			if(v->next_hop == 0 && v->vec->ls_type == OSPF_ROUTER_LSA){
+				v->next_hop = v->id;
 			}
 		}
 	}
-	a->num_vertex = leaf - a->vertices;
 }
 
+/* RFC 5286 loop-free alternates for the transit vertices. A neighbor N
+   of the root S is a loop-free alternate for destination D when
+       D(N, D) < D(N, S) + D(S, D)          (Inequality 1)
+   so that traffic handed to N does not come back to S. The distances
+   from N come from a Dijkstra calculation rooted at N; of the
+   alternates other than the primary next hop the cheapest one (cost of
+   the link to N plus D(N, D)) is kept, and of equal ones the one with
+   the lowest Router ID. Stub networks, inter-area and external routes
+   inherit the alternate of the vertex they are reached through. */
+static void calculate_alternates(area *a){
+	int n = a->num_transit;
+	int root = a->spf_root;
+	for(int v = 0; v < n; v++){
+		a->vertices[v].backup_hop = 0;
+		a->vertices[v].backup_dist = INF;
+	}
+	if(spf_lfa == DISABLED){
+		return ;
+	}
+
+	/* the neighbors of the root: routers linked to it directly or
+	   through a transit network, and the cost of getting there */
+	const spf_graph *g = &a->graph;
+	int num_nbr = 0;
+	int *nbr = malloc(g->num_edge * sizeof(int));
+	int *nbr_cost = malloc(n * sizeof(int));
+	for(int e = g->start[root]; e < g->start[root + 1]; e++){
+		int k = g->to[e];
+		int first = (a->vertices[k].vec->ls_type == OSPF_ROUTER_LSA) ? e : g->start[k];
+		int last = (a->vertices[k].vec->ls_type == OSPF_ROUTER_LSA) ? e + 1 : g->start[k + 1];
+		for(int f = first; f < last; f++){
+			int r = g->to[f];
+			int cost = g->metric[e] + (f == e ? 0 : g->metric[f]);
+			if(r == root || a->vertices[r].vec->ls_type != OSPF_ROUTER_LSA){
+				continue;
+			}
+			int j;
+			for(j = 0; j < num_nbr && nbr[j] != r; j++);
+			if(j == num_nbr){
+				nbr[num_nbr++] = r;
+				nbr_cost[r] = cost;
+			}
+			else if(cost < nbr_cost[r]){
+				nbr_cost[r] = cost;
+			}
+		}
+	}
+
+	/* the tree rooted at S is kept for the incremental calculation */
+	int *saved_dist = malloc(n * sizeof(int));
+	int *saved_pre = malloc(n * sizeof(int));
+	memcpy(saved_dist, a->spf_dist, n * sizeof(int));
+	memcpy(saved_pre, a->spf_pre, n * sizeof(int));
+	for(int j = 0; j < num_nbr; j++){
+		int r = nbr[j];
+		in_addr_t id = a->vertices[r].id;
+		a->spf_root = r;
+		dijkstra(a, r);
+		a->spf_root = root;
+		int dist_ns = a->spf_dist[root];
+		for(int v = 0; v < n; v++){
+			vertex *d = &a->vertices[v];
+			if(v == root || d->dist >= INF || d->next_hop == 0 || d->next_hop == id ||
+				a->spf_dist[v] >= dist_ns + d->dist){
+				continue;
+			}
+			int cost = nbr_cost[r] + a->spf_dist[v];
+			if(cost < INF && (cost < d->backup_dist ||
+				(cost == d->backup_dist && ntohl(id) < ntohl(d->backup_hop)))){
+				d->backup_hop = id;
+				d->backup_dist = cost;
+			}
+		}
+	}
+	memcpy(a->spf_dist, saved_dist, n * sizeof(int));
+	memcpy(a->spf_pre, saved_pre, n * sizeof(int));
+	free(saved_dist);
+	free(saved_pre);
+	free(nbr);
+	free(nbr_cost);
+}
+
+static void count_intra(area *a, in_addr_t id, int delta){
+	uint64_t key = HASH_KEY(0, id);
+	int n = hash_index_get(&a->intra_count, key);
+	n = (n == -1 ? 0 : n) + delta;
+	if(n > 0){
+		hash_index_put(&a->intra_count, key, n);
+	}
+	else{
+		hash_index_del(&a->intra_count, key);
+	}
+}
+
+static int count_leaves(const vertex *v){
+	int num = 0;
+	if(v->dist < INF){
+		for(int j = 0; j < v->vec->num_link; j++){
+			num += (v->vec->links[j].type == RTR_LSA_STUB);
+		}
+	}
+	return num;
+}
+
+/* write the stub networks of transit vertex i from vertices[at] on */
+static void fill_leaves(area *a, int i, int at){
+	const vertex *v = &a->vertices[i];
+	if(v->dist >= INF){
+		return ;
+	}
+	for(const spf_link *lnk = v->vec->links; lnk < v->vec->links + v->vec->num_link; lnk++){
+		if(lnk->type == RTR_LSA_STUB){
+			vertex *leaf = &a->vertices[at++];
+			leaf->id = lnk->id;
+			leaf->network_mask = lnk->data;
+			leaf->next_hop = v->next_hop;
+			leaf->dist = v->dist + lnk->metric;
+			leaf->backup_hop = v->backup_hop;
+			leaf->backup_dist = (v->backup_dist + lnk->metric < INF) ? v->backup_dist + lnk->metric : INF;
+			leaf->lsa = v->lsa;
+			leaf->vec = NULL;
+			count_intra(a, leaf->id, +1);
+		}
+	}
+}
+
+/* The second stage of Section 16.1: the stub networks are added to the
+   tree as leaves, behind the transit vertices. */
+static void add_stub_leaves(area *a){
+	int num_leaf = 0;
+	hash_index_clear(&a->intra_count);
+	for(int i = 0; i < a->num_transit; i++){
+		a->vertices[i].network_mask = a->vertices[i].vec->network_mask;
+		a->spf_leaf[i] = a->num_transit + num_leaf;
+		num_leaf += count_leaves(&a->vertices[i]);
+		if(a->vertices[i].dist < INF){
+			count_intra(a, a->vertices[i].id, +1);
+		}
+	}
+	a->spf_leaf[a->num_transit] = a->num_transit + num_leaf;
+	area_reserve_vertices(a, a->num_transit + num_leaf);
+	a->num_vertex = a->num_transit + num_leaf;
+	for(int i = 0; i < a->num_transit; i++){
+		fill_leaves(a, i, a->spf_leaf[i]);
+	}
+}
+
+/* an intra-area path to a destination hides the inter-area ones */
+static void note_leaf_change(area *a, in_addr_t id){
+	key_set_add(&a->changed_inter, HASH_KEY(OSPF_SUMMARY_LSA, id));
+	key_set_add(&a->changed_inter, HASH_KEY(OSPF_ASBR_SUMMARY_LSA, id));
+}
+
+/* Only the stub links of router r have changed: its transit part of the
+   tree stays as it is, and only its own leaves are replaced. */
+static void update_stub_leaves(area *a, int r){
+	vertex *v = &a->vertices[r];
+	int i = lookup_lsa_first(a, OSPF_ROUTER_LSA, v->id);
+	if(i == -1){
+		return ;
+	}
+	/* install_lsa() has moved the LSA */
+	v->lsa = a->lsas[i];
+	v->vec = a->vecs[i];
+
+	int start = a->spf_leaf[r];
+	int end = a->spf_leaf[r + 1];
+	int delta = count_leaves(v) - (end - start);
+	for(int k = start; k < end; k++){
+		count_intra(a, a->vertices[k].id, -1);
+		note_leaf_change(a, a->vertices[k].id);
+	}
+	area_reserve_vertices(a, a->num_vertex + delta);
+	memmove(&a->vertices[end + delta], &a->vertices[end], (a->num_vertex - end) * sizeof(vertex));
+	a->num_vertex += delta;
+	for(int j = r + 1; j <= a->num_transit; j++){
+		a->spf_leaf[j] += delta;
+	}
+	fill_leaves(a, r, start);
+	for(int k = start; k < a->spf_leaf[r + 1]; k++){
+		note_leaf_change(a, a->vertices[k].id);
+	}
+}
+
+/* Rebuild the transit vertices from the database and their graph.
+   Returns FAILURE if this router has no router-LSA in the area. */
+static int load_transit_vertices(area *a){
+	int root = -1;
+	/* the rows of the previous graph stay valid as long as the
+	   vertices keep their positions */
+	int same = (a->graph.num_vertex > 0);
+	a->num_vertex = 0;
+	area_reserve_vertices(a, a->num_lsa);
+	reserve_spf_buffers(a, a->num_lsa);
+	hash_index_clear(&a->vertex_index);
+	for(int i = 0 ; i < a->num_lsa; i++){
+		if(a->vecs[i] != NULL){
+			vertex *v = add_vertex(a);
+			v->id = a->lsas[i]->link_state_id;
+			v->lsa = a->lsas[i];
+			v->vec = a->vecs[i];
+			v->dist = INF;
+			v->next_hop = 0;
+			uint64_t key = HASH_KEY(a->lsas[i]->ls_type, v->id);
+			if(v - a->vertices >= a->graph.num_vertex || a->spf_key[v - a->vertices] != key){
+				same = OSPFD_FALSE;
+			}
+			a->spf_key[v - a->vertices] = key;
+			hash_index_put(&a->vertex_index, a->spf_key[v - a->vertices], v - a->vertices);
+			if(a->lsas[i]->ls_type == OSPF_ROUTER_LSA && v->id == my_router_id){
+				root = v - a->vertices;
+			}
+		}
+	}
+	a->num_transit = a->num_vertex;
+	a->spf_root = root;
+	if(root == -1){
+		a->num_transit = a->num_vertex = 0;
+		a->graph.num_vertex = 0;
+		return FAILURE;
+	}
+	build_graph(a, !same);
+	return SUCCESS;
+}
+
+static void full_dijkstra(area *a){
+	if(load_transit_vertices(a) == SUCCESS){
+		dijkstra(a, a->spf_root);
+	}
+}
+
+/* The transit part of the tree (distances, parents, next hops and
+   alternates) is remembered for the last few topologies of the area,
+   found by a->topo_hash. A link that flaps brings the area back to a
+   topology it has had before, and the tree is then taken from here
+   instead of being calculated again. The least recently used entry
+   makes room for a new one. */
+static spf_memo *lookup_spf_memo(area *a){
+	for(int i = 0; i < SPF_MEMO_ENTRIES; i++){
+		if(a->memo[i].last_use && a->memo[i].topo_hash == a->topo_hash){
+			return &a->memo[i];
+		}
+	}
+	return NULL;
+}
+
+static void save_spf_memo(area *a){
+	spf_memo *m = &a->memo[0];
+	for(int i = 1; i < SPF_MEMO_ENTRIES && m->last_use; i++){
+		if(a->memo[i].last_use < m->last_use){
+			m = &a->memo[i];
+		}
+	}
+	int n = a->num_transit;
+	if(n > m->max){
+		m->max = n;
+		m->keys = realloc(m->keys, n * sizeof(uint64_t));
+		m->dist = realloc(m->dist, n * sizeof(int));
+		m->pre = realloc(m->pre, n * sizeof(int));
+		m->next_hop = realloc(m->next_hop, n * sizeof(in_addr_t));
+		m->backup_hop = realloc(m->backup_hop, n * sizeof(in_addr_t));
+		m->backup_dist = realloc(m->backup_dist, n * sizeof(uint16_t));
+	}
+	m->topo_hash = a->topo_hash;
+	m->last_use = ++a->memo_clock;
+	m->num = n;
+	m->root = a->spf_root;
+	memcpy(m->keys, a->spf_key, n * sizeof(uint64_t));
+	memcpy(m->dist, a->spf_dist, n * sizeof(int));
+	memcpy(m->pre, a->spf_pre, n * sizeof(int));
+	for(int v = 0; v < n; v++){
+		m->next_hop[v] = a->vertices[v].next_hop;
+		m->backup_hop[v] = a->vertices[v].backup_hop;
+		m->backup_dist[v] = a->vertices[v].backup_dist;
+	}
+}
+
+/* Take the transit part of the tree from m. The vertices may have
+   moved in the database since m was saved; they are matched by key.
+   If they do not match after all the previous tree is gone, and the
+   full calculation has to follow. */
+static int restore_spf_memo(area *a, spf_memo *m){
+	if(load_transit_vertices(a) == FAILURE || a->num_transit != m->num){
+		return FAILURE;
+	}
+	int *pos = a->spf_stack;
+	for(int i = 0; i < m->num; i++){
+		pos[i] = hash_index_get(&a->vertex_index, m->keys[i]);
+		if(pos[i] == -1){
+			return FAILURE;
+		}
+	}
+	if(pos[m->root] != a->spf_root){
+		return FAILURE;
+	}
+	for(int i = 0; i < m->num; i++){
+		vertex *v = &a->vertices[pos[i]];
+		a->spf_dist[pos[i]] = m->dist[i];
+		a->spf_pre[pos[i]] = (m->pre[i] == -1) ? -1 : pos[m->pre[i]];
+		v->dist = m->dist[i];
+		v->next_hop = m->next_hop[i];
+		v->backup_hop = m->backup_hop[i];
+		v->backup_dist = m->backup_dist[i];
+	}
+	m->last_use = ++a->memo_clock;
+	return SUCCESS;
+}
+
+/* whether two router-LSAs differ in their stub links only (a change
+   of bit B or E changes the router's routing table entries) */
+static int same_transit_links(const lsa_vec *a, const lsa_vec *b){
+	const spf_link *p = a->links, *p_end = a->links + a->num_link;
+	const spf_link *q = b->links, *q_end = b->links + b->num_link;
+	if(a->flags != b->flags){
+		return OSPFD_FALSE;
+	}
+	for(;;){
+		while(p < p_end && p->type == RTR_LSA_STUB){
+			p++;
+		}
+		while(q < q_end && q->type == RTR_LSA_STUB){
+			q++;
+		}
+		if(p == p_end || q == q_end){
+			return p == p_end && q == q_end;
+		}
+		if(p->id != q->id || p->data != q->data || p->type != q->type || p->metric != q->metric){
+			return OSPFD_FALSE;
+		}
+		p++;
+		q++;
+	}
+}
+
+/* Record what an installed LSA changes for the next routing table
+   calculation. old_vec and new_vec are the decoded previous and new
+   instances of a router-LSA or network-LSA (old_vec is NULL for a new
+   LSA). A router-LSA whose transit links are unchanged only affects the
+   leaves of its vertex; summary-LSAs and AS-external-LSAs only affect
+   their own destination. */
+void spf_note_change(area *a, const ospf_lsa_header *lsa_hdr, const lsa_vec *old_vec, const lsa_vec *new_vec){
+	switch(lsa_hdr->ls_type){
+	case OSPF_ROUTER_LSA:
+		if(old_vec != NULL && same_transit_links(old_vec, new_vec) &&
+			hash_index_get(&a->vertex_index, HASH_KEY(OSPF_ROUTER_LSA, new_vec->id)) != -1){
+			key_set_add(&a->changed_leaves, HASH_KEY(OSPF_ROUTER_LSA, new_vec->id));
+			break;
+		}
+		/* fall through */
+	case OSPF_NETWORK_LSA:
+		if(a->num_spf_change == SPF_INCREMENTAL_MAX_CHANGES){
+			a->spf_full = OSPFD_TRUE;
+			break;
+		}
+		a->spf_changes[a->num_spf_change++] = HASH_KEY(new_vec->ls_type, new_vec->id);
+		break;
+	case OSPF_SUMMARY_LSA:
+	case OSPF_ASBR_SUMMARY_LSA:
+		key_set_add(&a->changed_inter, HASH_KEY(lsa_hdr->ls_type, lsa_hdr->link_state_id));
+		break;
+	case OSPF_AS_EXTERNAL_LSA:
+		key_set_add(&a->changed_external, HASH_KEY(lsa_hdr->ls_type, lsa_hdr->link_state_id));
+		break;
+	}
+	spf_schedule(a);
+}
 
 /* (2) The intra-area routes are calculated by building the shortest-
    path tree for each attached area. In particular, all routing
@@ -107,45 +966,120 @@ void dijkstra(area *a, int root){
    are incorporated into the tree. During the area’s shortest-path
    tree calculation, the area’s TransitCapability is also
    calculated for later use in Step 4. */
+/* (4) of Section 16.1: a routing table entry of type "router" for
+   each area border router and AS boundary router reached */
+static void index_border_routers(area *a){
+	vertex_set_clear(&a->abr);
+	vertex_set_clear(&a->asbr);
+	for(int i = 0; i < a->num_transit; i++){
+		const vertex *v = &a->vertices[i];
+		if(i == a->spf_root || v->vec->ls_type != OSPF_ROUTER_LSA || v->dist >= INF){
+			continue;
+		}
+		uint64_t key = HASH_KEY(OSPF_ROUTER_LSA, v->id);
+		if(v->vec->flags & RTR_LSA_FLAGS_B){
+			*vertex_set_put(&a->abr, key) = *v;
+		}
+		if(v->vec->flags & RTR_LSA_FLAGS_E){
+			*vertex_set_put(&a->asbr, key) = *v;
+		}
+	}
+}
+
 void calculate_intra_routes(area *a){
-	int root;
-	for(int i = 0 ; i < a->num_lsa; i++){
-		if(a->lsas[i]->ls_type == OSPF_ROUTER_LSA || a->lsas[i]->ls_type == OSPF_NETWORK_LSA){
-			a->vertices[a->num_vertex].id = a->lsas[i]->link_state_id;
-			a->vertices[a->num_vertex].lsa = a->lsas[i];
-			a->vertices[a->num_vertex].dist = INF;
-			if(a->vertices[a->num_vertex].id == my_router_id){
-				root = a->num_vertex;
-			}
-			a->num_vertex++;
+	spf_memo *m = (spf_memo_enabled == ENABLED) ? lookup_spf_memo(a) : NULL;
+	if(m != NULL && restore_spf_memo(a, m) == FAILURE){
+		m = NULL;
+		a->spf_full = OSPFD_TRUE;
+	}
+	if(m == NULL){
+		if(spf_incremental == DISABLED || a->spf_full || a->num_transit == 0 ||
+			incremental_dijkstra(a) == FAILURE){
+			full_dijkstra(a);
+		}
+	}
+	a->num_spf_change = 0;
+	a->spf_full = OSPFD_FALSE;
+	if(a->num_transit == 0){
+		vertex_set_clear(&a->abr);
+		vertex_set_clear(&a->asbr);
+		return ;
+	}
+	if(m == NULL){
+		for(int i = 0; i < a->num_transit; i++){
+			a->vertices[i].dist = a->spf_dist[i];
+		}
+		calculate_next_hops(a);
+		calculate_alternates(a);
+		if(spf_memo_enabled == ENABLED){
+			save_spf_memo(a);
 		}
 	}
-	dijkstra(a, root);	
+	index_border_routers(a);
+	add_stub_leaves(a);
 }
 
 
+/* Section 16.2 for the single destination described by the
+   summary-LSAs of the given type and Link State ID: of all of them,
+   the cheapest path through a reachable area border router is kept. */
+static void calculate_inter_route(area *a, uint8_t ls_type, in_addr_t id){
+	uint64_t key = HASH_KEY(ls_type, id);
+	vertex best;
+	best.dist = INF;
+	/* (6) intra-area paths are always preferred */
+	if(hash_index_get(&a->intra_count, HASH_KEY(0, id)) == -1){
+		for(int i = lookup_lsa_first(a, ls_type, id); i != -1; i = a->lsa_next[i]){
+			const ospf_lsa_header *lsa_hdr = a->lsas[i];
+			const summary_lsa *slsa = (const summary_lsa *)((const uint8_t *)lsa_hdr +
+				sizeof(ospf_lsa_header));
+			uint32_t metric = ntohl(slsa->tos0metric) & LSINFINITY;
+			/* (1), (2) */
+			if(metric == LSINFINITY || ntohs(lsa_hdr->ls_age) == MAX_AGE || lsa_hdr->adv_router == my_router_id){
+				continue;
+			}
+			/* (4) */
+			const vertex *br = vertex_set_lookup(&a->abr, HASH_KEY(OSPF_ROUTER_LSA, lsa_hdr->adv_router));
+			if(br == NULL){
+				continue;
+			}
+			/* (7) */
+			uint32_t dist = br->dist + metric;
+			if(dist < best.dist){
+				best.id = id;
+				best.network_mask = slsa->network_mask;
+				best.next_hop = br->next_hop;
+				best.dist = dist;
+				best.backup_hop = br->backup_hop;
+				best.backup_dist = (br->backup_dist + metric < INF) ? br->backup_dist + metric : INF;
+				best.lsa = lsa_hdr;
+				best.vec = NULL;
+			}
+		}
+	}
+	if(best.dist < INF){
+		*vertex_set_put(&a->inter, key) = best;
+	}
+	else{
+		vertex_set_del(&a->inter, key);
+	}
+	/* the AS-external routes through this AS boundary router follow */
+	if(ls_type == OSPF_ASBR_SUMMARY_LSA){
+		key_set_add(&a->changed_asbr, id);
+	}
+}
+
 /* (3) The inter-area routes are calculated, through examination of
    summary-LSAs. If the router is attached to multiple areas
    (i.e., it is an area border router), only backbone summary-LSAs
    are examined. */
 void calculate_inter_routes(area *a){
+	vertex_set_clear(&a->inter);
 	for(int i = 0 ; i < a->num_lsa; i++){
-		if(a->lsas[i]->ls_type == OSPF_SUMMARY_LSA || a->lsas[i]->ls_type == OSPF_ASBR_SUMMARY_LSA){
-			summary_lsa *slsa = (summary_lsa *)((uint8_t *)a->lsas[i] + 
-				sizeof(ospf_lsa_header));
-			if(lookup_vertex_by_id(a, a->lsas[i]->link_state_id) < a->num_vertex){
-				continue;
-			}
-			int k = lookup_vertex_by_id(a, a->lsas[i]->adv_router);
-			if(k == a->num_vertex || a->vertices[k].dist == INF){
-				continue;
-			}
-			a->vertices[a->num_vertex].id = a->lsas[i]->link_state_id;
-			a->vertices[a->num_vertex].network_mask = slsa->network_mask;
-			a->vertices[a->num_vertex].next_hop = a->vertices[k].next_hop;
-			a->vertices[a->num_vertex].dist = a->vertices[k].dist + ntohl(slsa->tos0metric >> 4 << 4);
-			a->vertices[a->num_vertex].lsa = a->lsas[i];
-			a->num_vertex++;
+		const ospf_lsa_header *lsa_hdr = a->lsas[i];
+		if((lsa_hdr->ls_type == OSPF_SUMMARY_LSA || lsa_hdr->ls_type == OSPF_ASBR_SUMMARY_LSA) &&
+			lookup_lsa_first(a, lsa_hdr->ls_type, lsa_hdr->link_state_id) == i){
+			calculate_inter_route(a, lsa_hdr->ls_type, lsa_hdr->link_state_id);
 		}
 	}
 }
@@ -161,55 +1095,233 @@ void recalculate_transit_area_routes(area *a){
 	return ;
 }
 
+/* the preferred routing table entry for AS boundary router id: its
+   intra-area vertex or its inter-area route, whichever is cheaper */
+static const vertex *lookup_asbr(const area *a, in_addr_t id){
+	const vertex *t = vertex_set_lookup(&a->asbr, HASH_KEY(OSPF_ROUTER_LSA, id));
+	const vertex *v = vertex_set_lookup(&a->inter, HASH_KEY(OSPF_ASBR_SUMMARY_LSA, id));
+	if(v != NULL && (t == NULL || v->dist < t->dist)){
+		t = v;
+	}
+	return t;
+}
+
+/* Section 16.4 for the single destination described by the
+   AS-external-LSAs with Link State ID id. The distance of a type 2
+   route is that of the AS boundary router alone, its type 2 metric is
+   read from the AS-external-LSA. */
+static int best_as_external_route(const area *a, in_addr_t id, vertex *route){
+	vertex best;
+	best.dist = INF;
+	int best_type2 = OSPFD_FALSE;
+	uint32_t best_metric = 0;
+	for(int i = lookup_external_lsa_first(id); i != -1; i = as_external.lsa_next[i]){
+		const ospf_lsa_header *lsa_hdr = as_external.lsas[i];
+		const as_external_lsa *aelsa = (const as_external_lsa *)((const uint8_t *)lsa_hdr +
+			sizeof(ospf_lsa_header));
+		uint32_t metric = ntohl(aelsa->tos0.tos0metric) & LSINFINITY;
+		if(metric == LSINFINITY || lsa_hdr->adv_router == my_router_id){
+			continue;
+		}
+		/* If the forwarding address is set to 0.0.0.0, packets should
+           be sent to the ASBR itself. Among the multiple routing table
+           entries for the ASBR, select the preferred entry as follows.
+           If RFC1583Compatibility is set to "disabled", prune the set
+           of routing table entries for the ASBR as described in
+           Section 16.4.1. In any case, among the remaining routing
+           table entries, select the routing table entry with the least
+           cost; when there are multiple least cost routing table
+           entries the entry whose associated area has the largest OSPF
+           Area ID (when considered as an unsigned 32-bit integer) is
+           chosen. */
+		if(aelsa->tos0.forward_addr == 0){
+			if(RFC1583Compatibility == DISABLED){
+
+			}
+			const vertex *t = lookup_asbr(a, lsa_hdr->adv_router);
+			if(t == NULL){
+				continue;
+			}
+			/* (6) Compare the AS external path described by the LSA
+			   with the existing paths in R's routing table entry.
+			   Type 1 external paths are always preferred over type 2
+			   external paths. When all paths are type 2 external
+			   paths, the paths with the smallest advertised type 2
+			   metric are always preferred. */
+			int type2 = ((ntohl(aelsa->tos0.tos0metric) >> 24) & AS_EXT_RTR_FLAFS_E) != 0;
+			uint32_t dist = type2 ? t->dist : t->dist + metric;
+			if(dist >= INF){
+				continue;
+			}
+			int better;
+			if(best.dist == INF){
+				better = OSPFD_TRUE;
+			}
+			else if(type2 != best_type2){
+				better = !type2;
+			}
+			else if(type2 && metric != best_metric){
+				better = metric < best_metric;
+			}
+			else{
+				better = dist < best.dist;
+			}
+			if(better){
+				best_type2 = type2;
+				best_metric = metric;
+				best.id = id;
+				best.network_mask = aelsa->network_mask;
+				best.next_hop = t->next_hop;
+				best.dist = dist;
+				best.backup_hop = t->backup_hop;
+				best.backup_dist = type2 ? t->backup_dist :
+					(t->backup_dist + metric < INF) ? t->backup_dist + metric : INF;
+				best.lsa = lsa_hdr;
+				best.vec = NULL;
+			}
+		}
+		/* forwarding addresses are not supported yet */
+	}
+	*route = best;
+	return best.dist < INF;
+}
+
+/* An external route holds the AS-external-LSA instance it was
+   calculated from, which may be replaced in as_external before the
+   route is calculated again. */
+static void put_external_route(area *a, const vertex *route){
+	vertex *v = vertex_set_put(&a->external, HASH_KEY(OSPF_AS_EXTERNAL_LSA, route->id));
+	const ospf_lsa_header *old = v->lsa;
+	hold_lsa(route->lsa);
+	*v = *route;
+	if(old != NULL){
+		release_lsa(old);
+	}
+}
+
+static void del_external_route(area *a, in_addr_t id){
+	uint64_t key = HASH_KEY(OSPF_AS_EXTERNAL_LSA, id);
+	vertex *v = vertex_set_lookup(&a->external, key);
+	if(v != NULL){
+		release_lsa(v->lsa);
+		vertex_set_del(&a->external, key);
+	}
+}
+
+static void clear_external_routes(area *a){
+	for(int i = 0; i < a->external.num; i++){
+		release_lsa(a->external.entries[i].lsa);
+	}
+	vertex_set_clear(&a->external);
+}
+
+static void calculate_as_external_route(area *a, in_addr_t id){
+	vertex best;
+	if(best_as_external_route(a, id, &best)){
+		put_external_route(a, &best);
+	}
+	else{
+		del_external_route(a, id);
+	}
+}
+
+/* The AS-external-LSAs are split by position in the database into one
+   shard per thread of spf_pool. Each shard resolves its destinations
+   against the read-only ASBR entries into its own list, and the lists
+   are merged in shard order, which gives the same routes in the same
+   order as a single pass over the database would. */
+#define EXTERNAL_MIN_SHARD 256
+
+typedef struct external_shard{
+	int num;
+	int max;
+	vertex *routes;
+}external_shard;
+
+typedef struct external_step{
+	const area *a;
+	int num_shard;
+	external_shard *shards;
+}external_step;
+
+static void external_job(void *arg, int i){
+	external_step *s = arg;
+	const area *a = s->a;
+	external_shard *shard = &s->shards[i];
+	int from = (long)as_external.num_lsa * i / s->num_shard;
+	int to = (long)as_external.num_lsa * (i + 1) / s->num_shard;
+	for(int j = from; j < to; j++){
+		const ospf_lsa_header *lsa_hdr = as_external.lsas[j];
+		if(lookup_external_lsa_first(lsa_hdr->link_state_id) != j){
+			continue;
+		}
+		if(shard->num == shard->max){
+			shard->max = shard->max ? shard->max * 2 : EXTERNAL_MIN_SHARD;
+			shard->routes = realloc(shard->routes, shard->max * sizeof(vertex));
+		}
+		if(best_as_external_route(a, lsa_hdr->link_state_id, &shard->routes[shard->num])){
+			shard->num++;
+		}
+	}
+}
+
 /* (5) Routes to external destinations are calculated, through
    examination of AS-external-LSAs. The locations of the AS
    boundary routers (which originate the AS-external-LSAs) have
    been determined in steps 2-4. */
 /* only support a part */
 void calculate_as_external_routes(area *a){
-	for(int i = 0; i < a->num_lsa; i++){
-		if(a->lsas[i]->ls_type == OSPF_AS_EXTERNAL_LSA){
-			as_external_lsa *aelsa = (as_external_lsa *)((uint8_t *)a->lsas[i] + 
-				sizeof(ospf_lsa_header));
-			if((ntohl(aelsa->tos0.tos0metric) & 0x00ffffff) == LSINFINITY || a->lsas[i]->adv_router == my_router_id){
-				continue;
-			}
-			int k = lookup_vertex_by_id(a, a->lsas[i]->adv_router);
-			if(k == a->num_vertex){
-				continue;
-			}
-			/* If the forwarding address is set to 0.0.0.0, packets should
-               be sent to the ASBR itself. Among the multiple routing table
-               entries for the ASBR, select the preferred entry as follows.
-               If RFC1583Compatibility is set to "disabled", prune the set
-               of routing table entries for the ASBR as described in
-               Section 16.4.1. In any case, among the remaining routing
-               table entries, select the routing table entry with the least
-               cost; when there are multiple least cost routing table
-               entries the entry whose associated area has the largest OSPF
-               Area ID (when considered as an unsigned 32-bit integer) is
-               chosen. */
-			if(aelsa->tos0.forward_addr == 0){
-				if(RFC1583Compatibility == DISABLED){
+	external_step s;
+	clear_external_routes(a);
+	if(!a->external_routing_capability){
+		return ;
+	}
+	s.a = a;
+	s.num_shard = as_external.num_lsa / EXTERNAL_MIN_SHARD;
+	if(s.num_shard > spf_pool.num_thread + 1){
+		s.num_shard = spf_pool.num_thread + 1;
+	}
+	if(s.num_shard < 1){
+		s.num_shard = 1;
+	}
+	s.shards = calloc(s.num_shard, sizeof(external_shard));
+	thread_pool_run(&spf_pool, s.num_shard, external_job, &s);
 
-				}
-				int t = lookup_least_cost_vertex_by_id(a, a->lsas[i]->adv_router);
-				if(t == a->num_vertex){
-					continue;
-				}
-				a->vertices[a->num_vertex].id = a->lsas[i]->adv_router;
-			    a->vertices[a->num_vertex].network_mask = aelsa->network_mask;
-			    a->vertices[a->num_vertex].next_hop = a->vertices[t].next_hop;
-			    a->vertices[a->num_vertex].dist = a->vertices[t].dist + ntohl(aelsa->tos0.tos0metric >> 4 << 4);
-			    a->vertices[a->num_vertex].lsa = a->lsas[i];
-			    a->num_vertex++;
-			}
-			else{
-				k = lookup_vertex_by_id(a, aelsa->tos0.forward_addr);
-				if(k == a->num_vertex){
-					continue;
-				}
+	for(int i = 0; i < s.num_shard; i++){
+		for(int j = 0; j < s.shards[i].num; j++){
+			put_external_route(a, &s.shards[i].routes[j]);
+		}
+		free(s.shards[i].routes);
+	}
+	free(s.shards);
+}
 
+/* 16.5. Incremental updates -- summary-LSAs
+   16.6. Incremental updates -- AS-external-LSAs */
+/* When the transit part of the tree is unchanged, only the leaves of
+   routers whose stub links changed and the destinations of changed
+   summary-LSAs and AS-external-LSAs are calculated again. An inter-area
+   route to an AS boundary router that changes brings the AS external
+   routes it originates along. */
+static void calculate_changed_routes(area *a){
+	for(int i = 0; i < a->changed_leaves.num; i++){
+		int r = hash_index_get(&a->vertex_index, a->changed_leaves.keys[i]);
+		if(r != -1){
+			update_stub_leaves(a, r);
+		}
+	}
+	for(int i = 0; i < a->changed_inter.num; i++){
+		uint64_t key = a->changed_inter.keys[i];
+		calculate_inter_route(a, (uint8_t)(key >> 32), (in_addr_t)key);
+	}
+	for(int i = 0; i < a->changed_external.num; i++){
+		calculate_as_external_route(a, (in_addr_t)a->changed_external.keys[i]);
+	}
+	if(a->changed_asbr.num > 0 && a->external_routing_capability){
+		for(int i = 0; i < as_external.num_lsa; i++){
+			const ospf_lsa_header *lsa_hdr = as_external.lsas[i];
+			if(hash_index_get(&a->changed_asbr.index, lsa_hdr->adv_router) != -1){
+				calculate_as_external_route(a, lsa_hdr->link_state_id);
 			}
 		}
 	}
@@ -219,9 +1331,82 @@ void shortest_path_tree(area *a){
 	/* (1) The present routing table is invalidated. The routing table is
        built again from scratch. The old routing table is saved so
        that changes in routing table entries can be identified. */
-	a->num_vertex = 0;
-	calculate_intra_routes(a);
-	calculate_inter_routes(a);
-	recalculate_transit_area_routes(a);
-	calculate_as_external_routes(a);
+	if(spf_incremental == DISABLED || a->spf_full || a->num_spf_change > 0 || a->num_transit == 0){
+		calculate_intra_routes(a);
+		calculate_inter_routes(a);
+		recalculate_transit_area_routes(a);
+		calculate_as_external_routes(a);
+	}
+	else{
+		calculate_changed_routes(a);
+	}
+	key_set_clear(&a->changed_leaves);
+	key_set_clear(&a->changed_inter);
+	key_set_clear(&a->changed_external);
+	key_set_clear(&a->changed_asbr);
+	a->spf_dirty = OSPFD_FALSE;
+}
+
+/* SPF throttling. The state below is protected by lsdb_lock. */
+static int spf_pending;
+static struct timespec spf_first_change;
+static struct timespec spf_last_run;
+static int spf_cur_hold;
+
+static long elapsed_ms(const struct timespec *from, const struct timespec *to){
+	return (to->tv_sec - from->tv_sec) * 1000 + (to->tv_nsec - from->tv_nsec) / 1000000;
+}
+
+static void add_ms(struct timespec *t, long ms){
+	t->tv_sec += ms / 1000;
+	t->tv_nsec += (ms % 1000) * 1000000;
+	if(t->tv_nsec >= 1000000000){
+		t->tv_sec += 1;
+		t->tv_nsec -= 1000000000;
+	}
+}
+
+/* Mark the area for recalculation and wake up spf_wait(); the caller
+   holds lsdb_lock. */
+void spf_schedule(area *a){
+	a->spf_dirty = OSPFD_TRUE;
+	if(spf_pending){
+		return ;
+	}
+	spf_pending = OSPFD_TRUE;
+	clock_gettime(CLOCK_MONOTONIC, &spf_first_change);
+	pthread_cond_signal(&spf_cond);
+}
+
+/* Block until the routing table is due to be calculated, with lsdb_lock
+   held. The calculation runs spf_initial_delay after the first change,
+   but no sooner than the hold time after the previous calculation. The
+   hold time starts at spf_hold_time and doubles with every calculation
+   made while changes keep coming, up to spf_max_wait; once the database
+   has been quiet for twice the hold time it is dropped again. */
+void spf_wait(){
+	while(!spf_pending){
+		pthread_cond_wait(&spf_cond, &lsdb_lock);
+	}
+	if(elapsed_ms(&spf_last_run, &spf_first_change) > 2 * spf_cur_hold){
+		spf_cur_hold = 0;
+	}
+	struct timespec deadline = spf_first_change;
+	struct timespec hold = spf_last_run;
+	add_ms(&deadline, spf_initial_delay);
+	add_ms(&hold, spf_cur_hold);
+	if(elapsed_ms(&deadline, &hold) > 0){
+		deadline = hold;
+	}
+	while(pthread_cond_timedwait(&spf_cond, &lsdb_lock, &deadline) != ETIMEDOUT){
+		;
+	}
+	spf_pending = OSPFD_FALSE;
+	clock_gettime(CLOCK_MONOTONIC, &spf_last_run);
+	if(spf_cur_hold == 0){
+		spf_cur_hold = spf_hold_time;
+	}
+	else{
+		spf_cur_hold = (spf_cur_hold * 2 < spf_max_wait) ? spf_cur_hold * 2 : spf_max_wait;
+	}
 }
@@ -193,6 +193,10 @@
    Otherwise, if the new path is the same cost, add it to the
    list of paths that appear in the routing table entry. */
 
+void spf_note_change(area *a, const ospf_lsa_header *lsa_hdr, const lsa_vec *old_vec, const lsa_vec *new_vec);
 void shortest_path_tree(area *a);
+void dijkstra(area *a, int root);
+void spf_schedule(area *a);
+void spf_wait();
 
 #endif
@@ -0,0 +1,183 @@
+/* Database Description exchange (Section 10.6 and 10.8), run against
+   process_dd_pkt() and encapsulate_dd_pkt() without a network: once
+   with this router as the slave and once as the master. Run by
+   "make check". */
+#include "ospfd.h"
+#include "dd.h"
+#include "lsa.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_TEST_LSA 200
+
+static int failures = 0;
+
+#define CHECK(cond) do{ \
+	if(!(cond)){ \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+}while(0)
+
+/* an area of its own with NUM_TEST_LSA summary-LSAs, and an interface
+   to it */
+static interface_data *setup(uint32_t area_id, in_addr_t router_id){
+	my_router_id = router_id;
+	area *a = area_init(area_id);
+	interface_data *iface = &ifs[num_if++];
+	iface->area_id = area_id;
+	iface->mtu = 1500;
+	iface->rxmt_interval = OSPF_DEFAULT_RXMT_INTERVAL;
+	strcpy(iface->if_name, "test0");
+	add_area_ifs(a, iface);
+
+	uint8_t buf[sizeof(ospf_lsa_header) + sizeof(summary_lsa)];
+	ospf_lsa_header *lsa_hdr = (ospf_lsa_header *)buf;
+	for(int i = 0; i < NUM_TEST_LSA; i++){
+		memset(buf, 0, sizeof(buf));
+		lsa_hdr->ls_type = OSPF_SUMMARY_LSA;
+		lsa_hdr->link_state_id = htonl(0x0a000000 + i);
+		lsa_hdr->adv_router = router_id;
+		lsa_hdr->ls_seqnum = htonl(LS_INIT_SEQ_NUM);
+		lsa_hdr->length = htons(sizeof(buf));
+		install_lsa(a, lsa_hdr);
+	}
+	return iface;
+}
+
+static neighbor *new_neighbor(interface_data *iface, in_addr_t router_id){
+	neighbor *nbr = calloc(1, sizeof(neighbor));
+	nbr->state = NEIGHBOR_STATE_EX_START;
+	nbr->master_slave_relationship = DD_MASTER;
+	nbr->dd_seqnum = DEFAULT_DD_SEQ_NUM_BEGIN;
+	nbr->rto = iface->rxmt_interval * 1000;
+	nbr->more = 1;
+	nbr->neighbor_id = router_id;
+	nbr->neighbor_ip = router_id;
+	iface->neighbors = nbr;
+	iface->num_neighbor = 1;
+	return nbr;
+}
+
+/* an empty Database Description packet from the neighbor */
+static ospf_header *peer_dd(uint8_t *buf, in_addr_t router_id, uint8_t flags, uint32_t seqnum){
+	ospf_header *ospf_hdr = (ospf_header *)buf;
+	ospf_dd_pkt *dd = (ospf_dd_pkt *)(buf + sizeof(ospf_header));
+	memset(buf, 0, sizeof(ospf_header) + sizeof(ospf_dd_pkt));
+	ospf_hdr->type = MSG_TYPE_DATABASE_DESCRIPTION;
+	ospf_hdr->pktlen = htons(sizeof(ospf_header) + sizeof(ospf_dd_pkt));
+	ospf_hdr->router_id = router_id;
+	dd->interface_mtu = htons(1500);
+	dd->options = OSPF_OPTIONS;
+	dd->flags = flags;
+	dd->dd_seqnum = htonl(seqnum);
+	return ospf_hdr;
+}
+
+static int dd_num_lsa(const ospf_header *ospf_hdr){
+	return (ntohs(ospf_hdr->pktlen) - sizeof(ospf_header) - sizeof(ospf_dd_pkt)) / sizeof(ospf_lsa_header);
+}
+
+/* The neighbor has the larger Router ID and is the master: the router
+   adopts the master's DD sequence number and answers each packet with
+   the next page of its database, moving on only when the master's
+   sequence number moves on. */
+static void test_slave(){
+	in_addr_t peer_id = htonl(2);
+	interface_data *iface = setup(1, htonl(1));
+	neighbor *nbr = new_neighbor(iface, peer_id);
+	uint8_t in[BUFFER_SIZE], out[BUFFER_SIZE];
+	ospf_header *sent = (ospf_header *)out;
+	ospf_dd_pkt *sent_dd = (ospf_dd_pkt *)(out + sizeof(ospf_header));
+	uint32_t seq = 5000;
+
+	process_dd_pkt(iface, nbr, peer_dd(in, peer_id, DD_FLAG_I | DD_FLAG_M | DD_FLAG_MS, seq));
+	CHECK(nbr->master_slave_relationship == DD_SLAVE);
+	CHECK(nbr->state == NEIGHBOR_STATE_EXCHANGE);
+	CHECK(nbr->dd_seqnum == seq);
+	CHECK(nbr->num_db_summary == NUM_TEST_LSA);
+
+	int described = 0;
+	while(nbr->state == NEIGHBOR_STATE_EXCHANGE && described < NUM_TEST_LSA){
+		/* the slave echoes the master's sequence number */
+		encapsulate_dd_pkt(iface, nbr, sent);
+		CHECK(ntohl(sent_dd->dd_seqnum) == seq);
+		CHECK(!(sent_dd->flags & (DD_FLAG_I | DD_FLAG_MS)));
+		int num = dd_num_lsa(sent);
+		CHECK(num > 0);
+		described += num;
+		CHECK(((sent_dd->flags & DD_FLAG_M) != 0) == (described < NUM_TEST_LSA));
+
+		/* a duplicate of the master's last packet is not an
+		   acknowledgment */
+		process_dd_pkt(iface, nbr, peer_dd(in, peer_id, DD_FLAG_M | DD_FLAG_MS, seq));
+		CHECK(nbr->dd_seqnum == seq);
+		CHECK(nbr->db_cursor == described - num);
+
+		seq++;
+		process_dd_pkt(iface, nbr, peer_dd(in, peer_id, DD_FLAG_MS | (described < NUM_TEST_LSA ? DD_FLAG_M : 0), seq));
+		CHECK(nbr->dd_seqnum == seq);
+		CHECK(nbr->db_cursor == described);
+	}
+	CHECK(described == NUM_TEST_LSA);
+	CHECK(nbr->more == 0);
+}
+
+/* The router has the larger Router ID and is the master: the slave
+   acknowledges each packet by echoing its sequence number, and the
+   exchange is done once both have nothing more to describe. */
+static void test_master(){
+	in_addr_t peer_id = htonl(1);
+	interface_data *iface = setup(2, htonl(2));
+	neighbor *nbr = new_neighbor(iface, peer_id);
+	uint8_t in[BUFFER_SIZE], out[BUFFER_SIZE];
+	ospf_header *sent = (ospf_header *)out;
+	ospf_dd_pkt *sent_dd = (ospf_dd_pkt *)(out + sizeof(ospf_header));
+
+	/* the slave's own initial packet does not make it the master */
+	process_dd_pkt(iface, nbr, peer_dd(in, peer_id, DD_FLAG_I | DD_FLAG_M | DD_FLAG_MS, 7000));
+	CHECK(nbr->master_slave_relationship == DD_MASTER);
+	CHECK(nbr->state == NEIGHBOR_STATE_EX_START);
+
+	uint32_t seq = nbr->dd_seqnum;
+	encapsulate_dd_pkt(iface, nbr, sent);
+	CHECK((sent_dd->flags & (DD_FLAG_I | DD_FLAG_M | DD_FLAG_MS)) == (DD_FLAG_I | DD_FLAG_M | DD_FLAG_MS));
+	CHECK(ntohl(sent_dd->dd_seqnum) == seq);
+
+	process_dd_pkt(iface, nbr, peer_dd(in, peer_id, DD_FLAG_M, seq));
+	CHECK(nbr->state == NEIGHBOR_STATE_EXCHANGE);
+	CHECK(nbr->dd_seqnum == seq + 1);
+
+	int described = 0, pkts = 0;
+	while(nbr->state == NEIGHBOR_STATE_EXCHANGE && pkts++ < NUM_TEST_LSA){
+		seq = nbr->dd_seqnum;
+		encapsulate_dd_pkt(iface, nbr, sent);
+		CHECK(ntohl(sent_dd->dd_seqnum) == seq);
+		CHECK(sent_dd->flags & DD_FLAG_MS);
+		int num = dd_num_lsa(sent);
+
+		/* an echo of an older sequence number is not an acknowledgment */
+		process_dd_pkt(iface, nbr, peer_dd(in, peer_id, 0, seq - 1));
+		CHECK(nbr->dd_seqnum == seq);
+
+		process_dd_pkt(iface, nbr, peer_dd(in, peer_id, 0, seq));
+		CHECK(nbr->dd_seqnum == seq + 1);
+		described += num;
+	}
+	CHECK(described == NUM_TEST_LSA);
+	CHECK(nbr->state == NEIGHBOR_STATE_LOADING);
+}
+
+int main(void){
+	global_value_init();
+	test_slave();
+	test_master();
+	if(failures){
+		fprintf(stderr, "test_dd: %d checks failed\n", failures);
+		return 1;
+	}
+	fprintf(stderr, "test_dd: passed\n");
+	return 0;
+}
@@ -0,0 +1,209 @@
+/* The flooding procedure (Section 13), run against process_lsu_pkt()
+   and encapsulate_flood_pkt() without a network: a newer, the same and
+   an older instance of an LSA received from a neighbor (steps 5, 7 and
+   8), and a burst of updates flooded out another interface. Run by
+   "make check". */
+#include "ospfd.h"
+#include "lsu.h"
+#include "lsa.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* router-LSAs with two stub links are 48 bytes long */
+#define TEST_LSA_LEN (sizeof(ospf_lsa_header) + sizeof(router_lsa) + 2 * sizeof(mylink))
+#define NUM_BURST_LSA 500
+#define NUM_BURST_LSU 20
+
+static int failures = 0;
+
+#define CHECK(cond) do{ \
+	if(!(cond)){ \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+}while(0)
+
+/* an interface of area area_id with a Full neighbor on it */
+static interface_data *setup_if(uint32_t area_id, const char *name, in_addr_t nbr_id){
+	area *a = area_init(area_id);
+	interface_data *iface = &ifs[num_if++];
+	iface->area_id = area_id;
+	iface->mtu = 1500;
+	iface->rxmt_interval = OSPF_DEFAULT_RXMT_INTERVAL;
+	strcpy(iface->if_name, name);
+	add_area_ifs(a, iface);
+
+	neighbor *nbr = calloc(1, sizeof(neighbor));
+	nbr->state = NEIGHBOR_STATE_FULL;
+	nbr->rto = iface->rxmt_interval * 1000;
+	nbr->neighbor_id = nbr_id;
+	nbr->neighbor_ip = nbr_id;
+	iface->neighbors = nbr;
+	iface->num_neighbor = 1;
+	return iface;
+}
+
+/* the router-LSA of router id, instance seqnum, with its checksum */
+static const ospf_lsa_header *router_lsa_of(uint8_t *buf, in_addr_t id, int32_t seqnum){
+	memset(buf, 0, TEST_LSA_LEN);
+	ospf_lsa_header *lsa_hdr = (ospf_lsa_header *)buf;
+	router_lsa *rl = (router_lsa *)(buf + sizeof(ospf_lsa_header));
+	for(int i = 0; i < 2; i++){
+		rl->links[i].id = htonl(0xc0000000 | (ntohl(id) << 8) | i);
+		rl->links[i].data = htonl(0xffffffff);
+		rl->links[i].type = RTR_LSA_STUB;
+		rl->links[i].metric = htons(1);
+	}
+	rl->num_link = htons(2);
+	lsa_hdr->ls_type = OSPF_ROUTER_LSA;
+	lsa_hdr->link_state_id = id;
+	lsa_hdr->adv_router = id;
+	lsa_hdr->ls_seqnum = htonl(seqnum);
+	lsa_hdr->length = htons(TEST_LSA_LEN);
+	lsa_hdr->ls_chksum = htons(fletcher16(buf + sizeof(lsa_hdr->ls_age), TEST_LSA_LEN - sizeof(lsa_hdr->ls_age)));
+	return lsa_hdr;
+}
+
+/* a Link State Update packet in buf, with no LSAs yet */
+static ospf_header *lsu_pkt(uint8_t *buf, in_addr_t router_id){
+	ospf_header *ospf_hdr = (ospf_header *)buf;
+	memset(buf, 0, sizeof(ospf_header) + sizeof(ospf_lsu_pkt));
+	ospf_hdr->type = MSG_TYPE_LINK_STATE_UPDATE;
+	ospf_hdr->pktlen = htons(sizeof(ospf_header) + sizeof(ospf_lsu_pkt));
+	ospf_hdr->router_id = router_id;
+	return ospf_hdr;
+}
+
+static void lsu_add(ospf_header *ospf_hdr, in_addr_t id, int32_t seqnum){
+	ospf_lsu_pkt *lsu = (ospf_lsu_pkt *)((uint8_t *)ospf_hdr + sizeof(ospf_header));
+	router_lsa_of((uint8_t *)ospf_hdr + ntohs(ospf_hdr->pktlen), id, seqnum);
+	lsu->num_of_lsa = htonl(ntohl(lsu->num_of_lsa) + 1);
+	ospf_hdr->pktlen = htons(ntohs(ospf_hdr->pktlen) + TEST_LSA_LEN);
+}
+
+/* one LSA received from the neighbor on iface in an update of its own */
+static void receive(interface_data *iface, in_addr_t id, int32_t seqnum){
+	uint8_t in[BUFFER_SIZE];
+	ospf_header *ospf_hdr = lsu_pkt(in, iface->neighbors->neighbor_id);
+	lsu_add(ospf_hdr, id, seqnum);
+	process_lsu_pkt(iface, iface->neighbors, ospf_hdr);
+}
+
+/* The neighbor on one interface sends instances of an LSA; a second
+   interface of the area has a Full neighbor of its own. */
+static void test_receive(){
+	interface_data *iface = setup_if(1, "test0", htonl(2));
+	interface_data *other = setup_if(1, "test1", htonl(3));
+	neighbor *nbr = iface->neighbors;
+	area *a = lookup_area_by_if(iface);
+	in_addr_t id = htonl(100);
+	uint8_t buf[BUFFER_SIZE];
+	const ospf_lsa_header *lsa_hdr = router_lsa_of(buf, id, LS_INIT_SEQ_NUM);
+	const ospf_lsa_header *db;
+
+	/* (5) the first instance is installed and flooded out the other
+	   interface; it is not flooded back out the receiving one, so it
+	   is acknowledged with the delayed acknowledgments */
+	receive(iface, id, LS_INIT_SEQ_NUM);
+	db = lookup_lsa(a, lsa_hdr);
+	CHECK(db != NULL && ntohl(db->ls_seqnum) == (uint32_t)LS_INIT_SEQ_NUM);
+	CHECK(lsa_list_lookup(&iface->delayed_acks, lsa_hdr) != NULL);
+	CHECK(nbr->lsacks.num == 0);
+	CHECK(iface->flood_queue.num == 0);
+	CHECK(lsa_list_lookup(&other->flood_queue, lsa_hdr) != NULL);
+	CHECK(lsa_list_lookup(&other->neighbors->flood_pending, lsa_hdr) != NULL);
+
+	/* (7) the same instance again is not installed again, and is
+	   acknowledged directly to the neighbor */
+	uint64_t version = a->lsdb_version;
+	int delayed = iface->delayed_acks.num;
+	receive(iface, id, LS_INIT_SEQ_NUM);
+	CHECK(a->lsdb_version == version);
+	CHECK(iface->delayed_acks.num == delayed);
+	CHECK(lsa_list_lookup(&nbr->lsacks, lsa_hdr) != NULL);
+
+	/* (7a) when it is on the neighbor's retransmission list it is an
+	   implied acknowledgment, and is not acknowledged */
+	lsa_list_clear(&nbr->lsacks);
+	add_rxmt_lsa(nbr, db, monotonic_ms());
+	receive(iface, id, LS_INIT_SEQ_NUM);
+	CHECK(lsa_list_lookup(&nbr->rxmt, lsa_hdr) == NULL);
+	CHECK(nbr->lsacks.num == 0);
+	CHECK(iface->delayed_acks.num == delayed);
+
+	/* (5) a more recent instance replaces the database copy */
+	receive(iface, id, LS_INIT_SEQ_NUM + 1);
+	db = lookup_lsa(a, lsa_hdr);
+	CHECK(db != NULL && ntohl(db->ls_seqnum) == (uint32_t)LS_INIT_SEQ_NUM + 1);
+	CHECK(nbr->lsacks.num == 0);
+
+	/* (8) an older instance is neither installed nor acknowledged; the
+	   database copy goes back to the neighbor in an update of its own,
+	   and not on its retransmission list */
+	lsa_list_clear(&iface->delayed_acks);
+	receive(iface, id, LS_INIT_SEQ_NUM);
+	db = lookup_lsa(a, lsa_hdr);
+	CHECK(db != NULL && ntohl(db->ls_seqnum) == (uint32_t)LS_INIT_SEQ_NUM + 1);
+	CHECK(nbr->lsacks.num == 0);
+	CHECK(iface->delayed_acks.num == 0);
+	CHECK(lsa_list_lookup(&nbr->rxmt, lsa_hdr) == NULL);
+	CHECK(nbr->txq.depth == 1);
+	tx_packet *p = tx_dequeue(nbr, monotonic_ms());
+	CHECK(p != NULL);
+	if(p != NULL){
+		const ospf_header *sent = (const ospf_header *)(p->data + sizeof(struct iphdr));
+		const ospf_lsu_pkt *lsu = (const ospf_lsu_pkt *)((const uint8_t *)sent + sizeof(ospf_header));
+		const ospf_lsa_header *back = (const ospf_lsa_header *)((const uint8_t *)lsu + sizeof(ospf_lsu_pkt));
+		CHECK(sent->type == MSG_TYPE_LINK_STATE_UPDATE);
+		CHECK(ntohl(lsu->num_of_lsa) == 1);
+		CHECK(back->link_state_id == id && ntohl(back->ls_seqnum) == (uint32_t)LS_INIT_SEQ_NUM + 1);
+		free(p);
+	}
+}
+
+/* A burst of NUM_BURST_LSA new LSAs received in NUM_BURST_LSU updates
+   is flooded out the other interface of the area in as few packets as
+   they fit: 30 LSAs of 48 bytes in each LSU of a 1500 byte MTU. */
+static void test_burst(){
+	interface_data *iface = setup_if(2, "test2", htonl(4));
+	interface_data *other = setup_if(2, "test3", htonl(5));
+	uint8_t in[BUFFER_SIZE], out[BUFFER_SIZE];
+	ospf_header *sent = (ospf_header *)out;
+
+	for(int i = 0; i < NUM_BURST_LSU; i++){
+		ospf_header *ospf_hdr = lsu_pkt(in, iface->neighbors->neighbor_id);
+		for(int j = 0; j < NUM_BURST_LSA / NUM_BURST_LSU; j++){
+			lsu_add(ospf_hdr, htonl(1000 + i * NUM_BURST_LSA / NUM_BURST_LSU + j), LS_INIT_SEQ_NUM);
+		}
+		process_lsu_pkt(iface, iface->neighbors, ospf_hdr);
+	}
+	CHECK(iface->delayed_acks.num == NUM_BURST_LSA);
+	CHECK(other->flood_queue.num == NUM_BURST_LSA);
+
+	int num_pkt = 0, num_lsa = 0, num;
+	while((num = encapsulate_flood_pkt(other, sent)) > 0){
+		CHECK(ntohs(sent->pktlen) <= ospf_packet_size(other));
+		num_pkt++;
+		num_lsa += num;
+	}
+	CHECK(num_pkt == 17);
+	CHECK(num_lsa == NUM_BURST_LSA);
+	CHECK(other->flood_queue.num == 0);
+	CHECK(other->neighbors->flood_pending.num == 0);
+	CHECK(other->neighbors->rxmt.num == NUM_BURST_LSA);
+}
+
+int main(void){
+	global_value_init();
+	my_router_id = htonl(1);
+	test_receive();
+	test_burst();
+	if(failures){
+		fprintf(stderr, "test_lsu: %d checks failed\n", failures);
+		return 1;
+	}
+	fprintf(stderr, "test_lsu: passed\n");
+	return 0;
+}
@@ -0,0 +1,477 @@
+/* Shortest-path tree calculation (Section 16.1), run through
+   shortest_path_tree() on a generated area: a grid of routers joined
+   by point-to-point links, some of them also attached to transit
+   networks. Run by "make check". */
+#include "ospfd.h"
+#include "lsa.h"
+#include "spf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_GRID 16
+#define MAX_ROUTER (MAX_GRID * MAX_GRID)
+#define NUM_LAN 6
+#define NUM_ROUND 300
+#define MAX_TREE (MAX_ROUTER * 4)
+#define NUM_TOPOLOGY 20
+#define NUM_THREAD 3
+#define SMALL_GRID 5
+#define NUM_SMALL (SMALL_GRID * SMALL_GRID + NUM_LAN)
+#define NUM_FLAP 50
+
+static int failures = 0;
+
+#define CHECK(cond) do{ \
+	if(!(cond)){ \
+		fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+		failures++; \
+	} \
+}while(0)
+
+/* The topology the LSAs are generated from: a grid of grid x grid
+   routers. Router r is the Router ID r + 1; metric[r][k] is the cost of its link to the neighbor in
+   direction k (left, right, up, down), 0 if the link is down. lan[r]
+   is the transit network r is attached to, or -1. */
+static int grid, num_router;
+static int metric[MAX_ROUTER][4];
+static int stub_metric[MAX_ROUTER];
+static int lan[MAX_ROUTER];
+static int lan_metric[MAX_ROUTER];
+static uint32_t seqnum[MAX_ROUTER + NUM_LAN];
+
+static int grid_neighbor(int r, int k){
+	int x = r % grid, y = r / grid;
+	switch(k){
+	case 0:
+		return x > 0 ? r - 1 : -1;
+	case 1:
+		return x < grid - 1 ? r + 1 : -1;
+	case 2:
+		return y > 0 ? r - grid : -1;
+	default:
+		return y < grid - 1 ? r + grid : -1;
+	}
+}
+
+/* the address of the Designated Router of transit network j, which is
+   its Link State ID */
+static in_addr_t lan_dr(int j){
+	return htonl(0x0b000001 | (j << 8));
+}
+
+static void install_router_lsa(area *a, int r){
+	uint8_t buf[BUFFER_SIZE];
+	memset(buf, 0, sizeof(buf));
+	ospf_lsa_header *lsa_hdr = (ospf_lsa_header *)buf;
+	router_lsa *rl = (router_lsa *)(buf + sizeof(ospf_lsa_header));
+	mylink *l = rl->links;
+	for(int k = 0; k < 4; k++){
+		if(grid_neighbor(r, k) != -1 && metric[r][k] != 0){
+			l->id = htonl(grid_neighbor(r, k) + 1);
+			l->data = htonl(0x0a000000 | r);
+			l->type = RTR_LSA_ROUTER;
+			l->metric = htons(metric[r][k]);
+			l++;
+		}
+	}
+	if(lan[r] != -1){
+		l->id = lan_dr(lan[r]);
+		l->data = htonl(0x0b000000 | (lan[r] << 8) | (r + 2));
+		l->type = RTR_LSA_TRANSIT;
+		l->metric = htons(lan_metric[r]);
+		l++;
+	}
+	l->id = htonl(0xc0000000 | (r << 8));
+	l->data = htonl(0xffffff00);
+	l->type = RTR_LSA_STUB;
+	l->metric = htons(stub_metric[r]);
+	l++;
+	rl->num_link = htons(l - rl->links);
+	lsa_hdr->ls_type = OSPF_ROUTER_LSA;
+	lsa_hdr->link_state_id = htonl(r + 1);
+	lsa_hdr->adv_router = htonl(r + 1);
+	lsa_hdr->ls_seqnum = htonl(LS_INIT_SEQ_NUM + seqnum[r]++);
+	lsa_hdr->length = htons((uint8_t *)l - buf);
+	install_lsa(a, lsa_hdr);
+}
+
+static void install_network_lsa(area *a, int j){
+	uint8_t buf[BUFFER_SIZE];
+	memset(buf, 0, sizeof(buf));
+	ospf_lsa_header *lsa_hdr = (ospf_lsa_header *)buf;
+	network_lsa *nl = (network_lsa *)(buf + sizeof(ospf_lsa_header));
+	nl->network_mask = htonl(0xffffff00);
+	int num = 0;
+	for(int r = 0; r < num_router; r++){
+		if(lan[r] == j){
+			nl->attached_rtrs[num++] = htonl(r + 1);
+		}
+	}
+	lsa_hdr->ls_type = OSPF_NETWORK_LSA;
+	lsa_hdr->link_state_id = lan_dr(j);
+	lsa_hdr->adv_router = htonl(1);
+	lsa_hdr->ls_seqnum = htonl(LS_INIT_SEQ_NUM + seqnum[MAX_ROUTER + j]++);
+	lsa_hdr->length = htons(sizeof(ospf_lsa_header) + sizeof(in_addr_t) * (num + 1));
+	install_lsa(a, lsa_hdr);
+}
+
+/* a random topology of size x size routers, with three routers on
+   each transit network */
+static area *setup(uint32_t area_id, int size){
+	area *a = area_init(area_id);
+	grid = size;
+	num_router = grid * grid;
+	my_router_id = htonl(grid / 2 * grid + grid / 2 + 1);
+	for(int r = 0; r < num_router; r++){
+		for(int k = 0; k < 4; k++){
+			metric[r][k] = 1 + rand() % 20;
+		}
+		stub_metric[r] = 1 + rand() % 3;
+		lan[r] = -1;
+		lan_metric[r] = 1 + rand() % 10;
+	}
+	for(int j = 0; j < NUM_LAN; j++){
+		for(int i = 0; i < 3; i++){
+			lan[(j * 11 + i * 7) % num_router] = j;
+		}
+	}
+	for(int r = 0; r < num_router; r++){
+		install_router_lsa(a, r);
+	}
+	for(int j = 0; j < NUM_LAN; j++){
+		install_network_lsa(a, j);
+	}
+	return a;
+}
+
+/* What the calculation leaves behind for the routing table: for each
+   vertex of the tree its key, distance, next hop and alternate, and
+   the key of its parent for the transit vertices. Transit vertices
+   are sorted by key and stub networks by address, so that trees whose
+   vertices are laid out differently can be compared. */
+typedef struct tree_entry{
+	uint64_t key;
+	uint64_t parent;
+	int dist;
+	in_addr_t next_hop;
+	in_addr_t backup_hop;
+	int backup_dist;
+}tree_entry;
+
+typedef struct tree{
+	int num_transit;
+	int num_vertex;
+	tree_entry entries[MAX_TREE];
+}tree;
+
+static int cmp_entry(const void *p, const void *q){
+	const tree_entry *a = p, *b = q;
+	if(a->key != b->key){
+		return a->key < b->key ? -1 : 1;
+	}
+	if(a->dist != b->dist){
+		return a->dist - b->dist;
+	}
+	return (a->next_hop > b->next_hop) - (a->next_hop < b->next_hop);
+}
+
+static void save_tree(const area *a, tree *t){
+	t->num_transit = a->num_transit;
+	t->num_vertex = a->num_vertex;
+	for(int i = 0; i < a->num_vertex && i < MAX_TREE; i++){
+		const vertex *v = &a->vertices[i];
+		tree_entry *e = &t->entries[i];
+		if(i < a->num_transit){
+			e->key = a->spf_key[i];
+			e->parent = (a->spf_pre[i] == -1) ? 0 : a->spf_key[a->spf_pre[i]];
+		}
+		else{
+			e->key = ((uint64_t)ntohl(v->id) << 32) | ntohl(v->network_mask);
+			e->parent = 0;
+		}
+		e->dist = v->dist;
+		e->next_hop = v->next_hop;
+		e->backup_hop = v->backup_hop;
+		e->backup_dist = v->backup_dist;
+	}
+	qsort(t->entries, t->num_transit, sizeof(tree_entry), cmp_entry);
+	qsort(t->entries + t->num_transit, t->num_vertex - t->num_transit, sizeof(tree_entry), cmp_entry);
+}
+
+static int same_tree(const tree *t, const tree *u){
+	return t->num_transit == u->num_transit && t->num_vertex == u->num_vertex &&
+		memcmp(t->entries, u->entries, t->num_vertex * sizeof(tree_entry)) == 0;
+}
+
+/* one random change to the topology: a link metric, a link going down
+   or coming back, the cost of a transit network link, or a router
+   joining or leaving a transit network */
+static void random_change(area *a){
+	int r = rand() % num_router;
+	int k = rand() % 4;
+	int what = rand() % 10;
+	if(what < 5){
+		metric[r][k] = 1 + rand() % 20;
+	}
+	else if(what < 8){
+		metric[r][k] = metric[r][k] ? 0 : 1 + rand() % 20;
+	}
+	else if(what < 9){
+		lan_metric[r] = 1 + rand() % 10;
+	}
+	else{
+		int j = (lan[r] == -1) ? rand() % NUM_LAN : lan[r];
+		lan[r] = (lan[r] == -1) ? j : -1;
+		install_network_lsa(a, j);
+	}
+	install_router_lsa(a, r);
+}
+
+static tree incremental, restored, full;
+
+/* After each round of changes the tree repaired by the incremental
+   calculation is the one calculated from scratch. */
+static void test_incremental(){
+	area *a = setup(1, MAX_GRID);
+	spf_incremental = ENABLED;
+	spf_memo_enabled = DISABLED;
+	shortest_path_tree(a);
+	CHECK(a->num_transit == num_router + NUM_LAN);
+	for(int round = 0; round < NUM_ROUND; round++){
+		int num_change = 1 + rand() % 3;
+		for(int i = 0; i < num_change; i++){
+			random_change(a);
+		}
+		shortest_path_tree(a);
+		save_tree(a, &incremental);
+		a->spf_full = OSPFD_TRUE;
+		shortest_path_tree(a);
+		save_tree(a, &full);
+		CHECK(same_tree(&incremental, &full));
+	}
+}
+
+static int seq_dist[MAX_TREE], seq_pre[MAX_TREE], seq_use[MAX_TREE];
+
+/* Delta-stepping on spf_pool finds the same distances, parents and
+   reached vertices as the sequential calculation, on topologies with
+   links down and unreachable parts. */
+static void test_delta_stepping(){
+	area *a = setup(2, MAX_GRID);
+	thread_pool_init(&spf_pool, NUM_THREAD);
+	for(int t = 0; t < NUM_TOPOLOGY; t++){
+		for(int i = 0; i < num_router; i++){
+			random_change(a);
+		}
+		spf_parallel_threshold = 0;
+		a->spf_full = OSPFD_TRUE;
+		shortest_path_tree(a);
+		int n = a->num_transit;
+		dijkstra(a, a->spf_root);
+		memcpy(seq_dist, a->spf_dist, n * sizeof(int));
+		memcpy(seq_pre, a->spf_pre, n * sizeof(int));
+		memcpy(seq_use, a->spf_use, n * sizeof(int));
+
+		spf_parallel_threshold = 1;
+		CHECK(thread_pool_idle(&spf_pool));
+		dijkstra(a, a->spf_root);
+		CHECK(memcmp(seq_dist, a->spf_dist, n * sizeof(int)) == 0);
+		CHECK(memcmp(seq_pre, a->spf_pre, n * sizeof(int)) == 0);
+		CHECK(memcmp(seq_use, a->spf_use, n * sizeof(int)) == 0);
+	}
+	spf_parallel_threshold = SPF_DEFAULT_PARALLEL_THRESHOLD;
+}
+
+/* the position of a transit vertex in the topology: router r is r,
+   transit network j is num_router + j */
+static int topology_index(const vertex *v){
+	if(v->vec->ls_type == OSPF_ROUTER_LSA){
+		return ntohl(v->id) - 1;
+	}
+	return num_router + ((ntohl(v->id) >> 8) & 0xff);
+}
+
+/* the cost of the cheapest link from router r to router q, directly or
+   through a transit network, -1 if there is none. As in the daemon, the
+   link between a router and a transit network costs the router's metric
+   in both directions. */
+static int neighbor_cost(int r, int q){
+	int cost = -1;
+	for(int k = 0; k < 4; k++){
+		if(grid_neighbor(r, k) == q && metric[r][k] && metric[q][k ^ 1]){
+			cost = metric[r][k];
+		}
+	}
+	if(lan[r] != -1 && lan[r] == lan[q] && (cost == -1 || lan_metric[r] + lan_metric[q] < cost)){
+		cost = lan_metric[r] + lan_metric[q];
+	}
+	return cost;
+}
+
+/* distances between all the transit vertices of the topology */
+static int fw[NUM_SMALL][NUM_SMALL];
+
+static void floyd_warshall(){
+	int n = num_router + NUM_LAN;
+	for(int i = 0; i < n; i++){
+		for(int j = 0; j < n; j++){
+			fw[i][j] = (i == j) ? 0 : INF;
+		}
+	}
+	for(int r = 0; r < num_router; r++){
+		for(int k = 0; k < 4; k++){
+			int q = grid_neighbor(r, k);
+			if(q != -1 && metric[r][k] && metric[q][k ^ 1]){
+				fw[r][q] = metric[r][k];
+			}
+		}
+		if(lan[r] != -1){
+			fw[r][num_router + lan[r]] = lan_metric[r];
+			fw[num_router + lan[r]][r] = lan_metric[r];
+		}
+	}
+	for(int k = 0; k < n; k++){
+		for(int i = 0; i < n; i++){
+			for(int j = 0; j < n; j++){
+				if(fw[i][k] + fw[k][j] < fw[i][j]){
+					fw[i][j] = fw[i][k] + fw[k][j];
+				}
+			}
+		}
+	}
+}
+
+/* The loop-free alternate of each transit vertex is the one found from
+   the Floyd-Warshall distances: the cheapest neighbor N of the root S,
+   other than the primary next hop, with D(N, D) < D(N, S) + D(S, D),
+   and of equal ones the lowest Router ID. The tree rooted at S is left
+   as it was before the alternates were calculated. */
+static void test_alternates(){
+	area *a = setup(3, SMALL_GRID);
+	int num_lfa = 0;
+	for(int t = 0; t < NUM_TOPOLOGY; t++){
+		/* metrics from a narrow range, so that equal-cost alternates
+		   are common, and a few links down */
+		for(int r = 0; r < num_router; r++){
+			for(int k = 0; k < 4; k++){
+				metric[r][k] = (rand() % 8) ? 1 + rand() % 3 : 0;
+			}
+			lan_metric[r] = 1 + rand() % 3;
+			install_router_lsa(a, r);
+		}
+		spf_lfa = DISABLED;
+		a->spf_full = OSPFD_TRUE;
+		shortest_path_tree(a);
+		int n = a->num_transit;
+		memcpy(seq_dist, a->spf_dist, n * sizeof(int));
+		memcpy(seq_pre, a->spf_pre, n * sizeof(int));
+		spf_lfa = ENABLED;
+		a->spf_full = OSPFD_TRUE;
+		shortest_path_tree(a);
+		CHECK(a->num_transit == n);
+		CHECK(memcmp(seq_dist, a->spf_dist, n * sizeof(int)) == 0);
+		CHECK(memcmp(seq_pre, a->spf_pre, n * sizeof(int)) == 0);
+
+		floyd_warshall();
+		int s = topology_index(&a->vertices[a->spf_root]);
+		for(int v = 0; v < n; v++){
+			const vertex *dv = &a->vertices[v];
+			int d = topology_index(dv);
+			CHECK(dv->dist == fw[s][d]);
+			int best = INF;
+			in_addr_t hop = 0;
+			for(int r = 0; r < num_router && v != a->spf_root && dv->dist < INF && dv->next_hop != 0; r++){
+				int cost = neighbor_cost(s, r);
+				if(r == s || cost == -1 || htonl(r + 1) == dv->next_hop ||
+					fw[r][d] >= fw[r][s] + fw[s][d]){
+					continue;
+				}
+				cost += fw[r][d];
+				if(cost < best){
+					best = cost;
+					hop = htonl(r + 1);
+				}
+			}
+			CHECK(dv->backup_hop == hop);
+			CHECK(dv->backup_dist == best);
+			num_lfa += (hop != 0);
+		}
+	}
+	CHECK(num_lfa > 0);
+}
+
+/* the entry of the memo saved for the area's present topology */
+static const spf_memo *present_memo(const area *a){
+	for(int i = 0; i < SPF_MEMO_ENTRIES; i++){
+		if(a->memo[i].last_use && a->memo[i].topo_hash == a->topo_hash){
+			return &a->memo[i];
+		}
+	}
+	return NULL;
+}
+
+/* A link that goes down and comes back, or a router that leaves a
+   transit network and joins it again, brings the area back to a
+   topology it has had: the tree is taken from the memo saved for it,
+   and is the one calculated from scratch. */
+static void test_memo_flap(){
+	area *a = setup(4, MAX_GRID);
+	spf_memo_enabled = ENABLED;
+	a->spf_full = OSPFD_TRUE;
+	shortest_path_tree(a);
+	for(int flap = 0; flap < NUM_FLAP; flap++){
+		const spf_memo *before = present_memo(a);
+		CHECK(before != NULL);
+		int r, k;
+		do{
+			r = rand() % num_router;
+			k = rand() % 4;
+		}while(grid_neighbor(r, k) == -1 || metric[r][k] == 0);
+		int j = lan[r];
+		if(flap % 2 == 0 || j == -1){
+			int m = metric[r][k];
+			metric[r][k] = 0;
+			install_router_lsa(a, r);
+			shortest_path_tree(a);
+			metric[r][k] = m;
+			install_router_lsa(a, r);
+		}
+		else{
+			lan[r] = -1;
+			install_router_lsa(a, r);
+			install_network_lsa(a, j);
+			shortest_path_tree(a);
+			lan[r] = j;
+			install_router_lsa(a, r);
+			install_network_lsa(a, j);
+		}
+		shortest_path_tree(a);
+		CHECK(present_memo(a) == before);
+		CHECK(before->last_use == a->memo_clock);
+		save_tree(a, &restored);
+
+		spf_memo_enabled = DISABLED;
+		a->spf_full = OSPFD_TRUE;
+		shortest_path_tree(a);
+		save_tree(a, &full);
+		spf_memo_enabled = ENABLED;
+		CHECK(same_tree(&restored, &full));
+	}
+}
+
+int main(void){
+	global_value_init();
+	srand(1);
+	test_incremental();
+	test_delta_stepping();
+	test_alternates();
+	test_memo_flap();
+	if(failures){
+		fprintf(stderr, "test_spf: %d checks failed\n", failures);
+		return 1;
+	}
+	fprintf(stderr, "test_spf: passed\n");
+	return 0;
+}